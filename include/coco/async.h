@@ -0,0 +1,319 @@
+#ifndef _COCO_ASYNC_H_
+#define _COCO_ASYNC_H_
+
+#include "coco/scheduler.h"
+#include "coco/slab.h"
+#include "coco/sync/futex.h"
+#include "coco/sync/future.h"
+#include "coco/task.h"
+#include "coco/thread_context.h"
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include <poll.h>
+#include <sys/types.h>
+
+namespace coco {
+
+/* stackless coroutines, built with COCO_ENABLE_COROUTINES (C++20). an
+ * async<T> does nothing until it is awaited by another one or started with
+ * launch(). the ready coroutines of a thread are resumed one after another
+ * by a driver task on its run queue, so a coroutine costs its frame but no
+ * stack. they wait for fds, futexes, futures and each other without holding
+ * up the driver, anything else which parks (e.g. a hooked read()) parks the
+ * driver and the other coroutines of the thread with it */
+
+template <typename T = void> class async;
+
+namespace detail {
+
+/* queue the coroutine on the thread, its driver is started if idle */
+void async_post(ThreadContext* thread, std::coroutine_handle<> handle);
+
+struct AsyncPromiseBase {
+    ThreadContext* thread = nullptr; /* whose driver resumes us */
+    std::coroutine_handle<> continuation;
+    std::exception_ptr eptr;
+    bool detached = false; /* started by launch(), nobody awaits it */
+
+    static void* operator new(size_t size) { return slab_alloc(size); }
+    static void operator delete(void* p, size_t size) { slab_free(p, size); }
+
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        void await_resume() const noexcept {}
+
+        template <typename P>
+        std::coroutine_handle<>
+        await_suspend(std::coroutine_handle<P> handle) noexcept
+        {
+            auto& promise = handle.promise();
+            if (promise.continuation) return promise.continuation;
+
+            if (promise.detached) {
+                auto* sched = promise.thread->get_scheduler();
+                handle.destroy();
+                sched->task_exited();
+            }
+            return std::noop_coroutine();
+        }
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { eptr = std::current_exception(); }
+};
+
+template <typename T> struct AsyncPromise : AsyncPromiseBase {
+    std::optional<T> value;
+
+    async<T> get_return_object();
+    template <typename U> void return_value(U&& v)
+    {
+        value.emplace(std::forward<U>(v));
+    }
+
+    T take()
+    {
+        if (eptr) std::rethrow_exception(eptr);
+        return std::move(*value);
+    }
+};
+
+template <> struct AsyncPromise<void> : AsyncPromiseBase {
+    async<void> get_return_object();
+    void return_void() {}
+
+    void take()
+    {
+        if (eptr) std::rethrow_exception(eptr);
+    }
+};
+
+/* posts the waiting coroutine back to its thread */
+struct AsyncWaker : Waker {
+    ThreadContext* thread = nullptr;
+    std::coroutine_handle<> handle;
+
+    AsyncWaker() : Waker{&AsyncWaker::wake_coroutine} {}
+
+    template <typename P> void set(std::coroutine_handle<P> handle)
+    {
+        this->thread = handle.promise().thread;
+        this->handle = handle;
+    }
+
+    /* the coroutine may be gone as soon as it is posted */
+    static void wake_coroutine(Waker* waker)
+    {
+        auto* self = static_cast<AsyncWaker*>(waker);
+        async_post(self->thread, self->handle);
+    }
+};
+
+template <typename T> class FutureAwaiter {
+public:
+    explicit FutureAwaiter(Future<T>&& future) : future(std::move(future)) {}
+
+    bool await_ready() const { return future.is_ready(); }
+
+    template <typename P> bool await_suspend(std::coroutine_handle<P> handle)
+    {
+        waker.set(handle);
+        auto& state = *future.state;
+        return state.waiters.wait(state.ready, uint8_t(0), &waker);
+    }
+
+    T await_resume() { return future.get(); }
+
+private:
+    Future<T> future;
+    AsyncWaker waker;
+};
+
+template <typename T> class FutexAwaiter {
+public:
+    FutexAwaiter(Futex<T>& futex, std::atomic<T>& uval, T old_val)
+        : futex(futex), uval(uval), old_val(old_val)
+    {}
+
+    bool await_ready() const { return false; }
+
+    template <typename P> bool await_suspend(std::coroutine_handle<P> handle)
+    {
+        waker.set(handle);
+        return futex.wait(uval, old_val, &waker);
+    }
+
+    void await_resume() {}
+
+private:
+    Futex<T>& futex;
+    std::atomic<T>& uval;
+    T old_val;
+    AsyncWaker waker;
+};
+
+class PollAwaiter {
+public:
+    PollAwaiter(int fd, short events) : fd(fd) { entry.events = events; }
+
+    bool await_ready() const { return false; }
+
+    template <typename P> bool await_suspend(std::coroutine_handle<P> handle)
+    {
+        waker.set(handle);
+        entry.waker = &waker;
+
+        /* fds the poller does not track are reported ready */
+        auto* poller = ThreadContext::get_current_io_poller();
+        if (!poller || !poller->add(fd, &entry)) {
+            entry.revents = entry.events;
+            return false;
+        }
+        return true;
+    }
+
+    short await_resume()
+    {
+        if (entry.pfd) entry.pfd->remove(&entry);
+        return entry.revents;
+    }
+
+private:
+    int fd;
+    PollEntry entry;
+    AsyncWaker waker;
+};
+
+} // namespace detail
+
+template <typename T> class [[nodiscard]] async {
+public:
+    using promise_type = detail::AsyncPromise<T>;
+
+    async(async&& other) noexcept : handle(std::exchange(other.handle, {}))
+    {}
+    async& operator=(async&& other) noexcept
+    {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+
+    ~async()
+    {
+        if (handle) handle.destroy();
+    }
+
+    bool valid() const { return (bool)handle; }
+
+    /* run by the awaiting coroutine, which it resumes once it returns */
+    bool await_ready() const noexcept { return false; }
+
+    template <typename P>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<P> caller) noexcept
+    {
+        handle.promise().thread = caller.promise().thread;
+        handle.promise().continuation = caller;
+        return handle;
+    }
+
+    T await_resume() { return handle.promise().take(); }
+
+private:
+    template <typename U> friend Future<U> launch(async<U> task);
+    friend promise_type;
+
+    using Handle = std::coroutine_handle<promise_type>;
+    Handle handle;
+
+    explicit async(Handle handle) : handle(handle) {}
+};
+
+template <typename T> async<T> detail::AsyncPromise<T>::get_return_object()
+{
+    return async<T>(async<T>::Handle::from_promise(*this));
+}
+
+inline async<void> detail::AsyncPromise<void>::get_return_object()
+{
+    return async<void>(async<void>::Handle::from_promise(*this));
+}
+
+namespace detail {
+
+template <typename T>
+async<void> run_detached(async<T> task, Promise<T> promise)
+{
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            promise.set_value();
+        } else {
+            promise.set_value(co_await task);
+        }
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
+
+} // namespace detail
+
+/* start the coroutine on the calling thread, or on the first worker of the
+ * default scheduler outside of tasks. it counts as a live task until it
+ * returns. stackful tasks wait for the future with get(), coroutines await
+ * it */
+template <typename T> Future<T> launch(async<T> task)
+{
+    Promise<T> promise;
+    auto future = promise.get_future();
+
+    auto root = detail::run_detached(std::move(task), std::move(promise));
+    auto handle = std::exchange(root.handle, {});
+
+    auto* sched = Scheduler::get_current();
+    auto* thread =
+        (sched ? *sched : Scheduler::get_instance()).get_spawn_thread();
+
+    handle.promise().thread = thread;
+    handle.promise().detached = true;
+    thread->get_scheduler()->task_started();
+    detail::async_post(thread, handle);
+
+    return future;
+}
+
+/* co_await future, e.g. for the result of a stackful task from submit() */
+template <typename T>
+detail::FutureAwaiter<T> operator co_await(Future<T>&& future)
+{
+    return detail::FutureAwaiter<T>(std::move(future));
+}
+
+/* co_await futex_wait(...) is Futex::wait() for coroutines */
+template <typename T>
+detail::FutexAwaiter<T> futex_wait(Futex<T>& futex, std::atomic<T>& uval,
+                                   T old_val)
+{
+    return detail::FutexAwaiter<T>(futex, uval, old_val);
+}
+
+/* the events of fd which are ready, once any of events is */
+inline detail::PollAwaiter async_poll(int fd, short events)
+{
+    return detail::PollAwaiter(fd, events);
+}
+
+/* read(2) and write(2) which wait for a hooked fd to become ready without
+ * parking the driver. errno is set on failure */
+async<ssize_t> async_read(int fd, void* buf, size_t count);
+async<ssize_t> async_write(int fd, const void* buf, size_t count);
+
+} // namespace coco
+
+#endif
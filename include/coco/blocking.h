@@ -0,0 +1,119 @@
+#ifndef _COCO_BLOCKING_H_
+#define _COCO_BLOCKING_H_
+
+#include "coco/preempt.h"
+#include "coco/thread_context.h"
+
+#include <condition_variable>
+#include <exception>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace coco {
+
+/* a call to be run on the blocking pool on behalf of a sleeping task */
+struct BlockingJob {
+    ThreadContext* thread;
+    Task* task;
+    BlockingJob* next;
+
+    virtual void run() = 0;
+};
+
+/* helper threads which run blocking calls so that only the calling task is
+ * parked instead of the whole worker */
+class BlockingPool {
+public:
+    static const size_t DEFAULT_MAX_THREADS = 16;
+
+    ~BlockingPool();
+
+    static BlockingPool& get_instance();
+
+    void set_max_threads(size_t n);
+
+    /* park the current task until the job is done */
+    void run(BlockingJob* job);
+
+private:
+    PreemptMutex mutex;
+    std::condition_variable_any cv;
+    BlockingJob* head;
+    BlockingJob* tail;
+    size_t max_threads;
+    size_t idle_threads;
+    bool stopped;
+    std::vector<std::thread> threads;
+
+    BlockingPool(size_t max_threads);
+
+    void submit(BlockingJob* job);
+    void worker_thread_func();
+};
+
+namespace detail {
+
+template <typename F, typename R> struct BlockingCall : public BlockingJob {
+    F& fn;
+    R result;
+    std::exception_ptr eptr;
+
+    BlockingCall(F& fn) : fn(fn), result(), eptr(nullptr) {}
+
+    void run() override
+    {
+        try {
+            result = fn();
+        } catch (...) {
+            eptr = std::current_exception();
+        }
+    }
+
+    R get()
+    {
+        if (eptr) std::rethrow_exception(eptr);
+        return std::move(result);
+    }
+};
+
+template <typename F> struct BlockingCall<F, void> : public BlockingJob {
+    F& fn;
+    std::exception_ptr eptr;
+
+    BlockingCall(F& fn) : fn(fn), eptr(nullptr) {}
+
+    void run() override
+    {
+        try {
+            fn();
+        } catch (...) {
+            eptr = std::current_exception();
+        }
+    }
+
+    void get()
+    {
+        if (eptr) std::rethrow_exception(eptr);
+    }
+};
+
+} // namespace detail
+
+/* run fn on the blocking pool and park the current task until it returns,
+ * outside of coroutine context fn is simply called */
+template <typename F> auto blocking(F&& fn) -> decltype(fn())
+{
+    if (!ThreadContext::get_current_task()) {
+        return fn();
+    }
+
+    detail::BlockingCall<F, decltype(fn())> call(fn);
+    BlockingPool::get_instance().run(&call);
+
+    return call.get();
+}
+
+} // namespace coco
+
+#endif
@@ -1,15 +1,82 @@
 #ifndef _COCO_H_
 #define _COCO_H_
 
+#include "coco/blocking.h"
+#include "coco/coop.h"
+#include "coco/growable_stack.h"
+#include "coco/histogram.h"
+#include "coco/join_handle.h"
+#include "coco/parallel.h"
+#include "coco/perf_map.h"
 #include "coco/scheduler.h"
+#include "coco/slab.h"
+#include "coco/stack_profile.h"
+#include "coco/stream.h"
+#include "coco/sync/future.h"
 #include "coco/thread_context.h"
+#include "coco/trace.h"
+#include "coco/zerocopy.h"
+
+#ifdef COCO_HAS_COROUTINES
+#include "coco/async.h"
+#endif
+
+#include <iostream>
+#include <memory>
+#include <type_traits>
 
 namespace coco {
 
 extern void go(std::function<void()>&& fn, size_t stacksize = 1 * 1024 * 1024);
+/* labeled tasks get their own scheduling latency histograms */
+extern void go(const char* label, std::function<void()>&& fn,
+               size_t stacksize = 1 * 1024 * 1024);
+/* same with the class looked up once by TaskClass::get() */
+extern void go(TaskClass* task_class, std::function<void()>&& fn,
+               size_t stacksize = 1 * 1024 * 1024);
+/* onto another scheduler than the calling task's or the default one */
+extern void go(Scheduler& sched, std::function<void()>&& fn,
+               size_t stacksize = 1 * 1024 * 1024);
 extern void run();
+/* join the workers kept by Scheduler::set_persistent() */
+extern void shutdown();
 extern void yield();
 
+/* list the tasks of every thread with the stacks of the parked ones. the
+ * stacks are walked by frame pointer, build with -fno-omit-frame-pointer */
+extern void dump_tasks(std::ostream& os = std::cerr);
+
+/* run fn as a task of sched, which may be another scheduler than the
+ * caller's, and pick up its result or exception with get() from a task of
+ * any scheduler. sched has to be running or run later for it to complete */
+template <typename F>
+auto submit(Scheduler& sched, F&& fn, size_t stacksize = 1 * 1024 * 1024)
+    -> Future<std::invoke_result_t<F>>
+{
+    using R = std::invoke_result_t<F>;
+
+    /* std::function wants a copyable callable */
+    auto promise = std::make_shared<Promise<R>>();
+    auto future = promise->get_future();
+
+    sched.go(
+        [promise, fn = std::forward<F>(fn)]() mutable {
+            try {
+                if constexpr (std::is_void_v<R>) {
+                    fn();
+                    promise->set_value();
+                } else {
+                    promise->set_value(fn());
+                }
+            } catch (...) {
+                promise->set_exception(std::current_exception());
+            }
+        },
+        stacksize);
+
+    return future;
+}
+
 } // namespace coco
 
 #endif
@@ -0,0 +1,30 @@
+#ifndef _COCO_COOP_H_
+#define _COCO_COOP_H_
+
+namespace coco {
+
+/* a task which keeps finding its fds ready and its locks free never parks
+ * and keeps the other tasks of its worker waiting. every hooked I/O call and
+ * lock which may return without parking takes one unit of the running
+ * task's budget, the task yields once the budget is used up and starts over
+ * with a full one whenever it is switched to. 0 turns it off */
+void set_coop_budget(unsigned int budget);
+unsigned int get_coop_budget();
+
+namespace detail {
+/* what is left of the budget of the task running on the thread, 0 while
+ * the thread is idle or not a worker */
+inline thread_local unsigned int coop_left = 0;
+
+void coop_yield();
+} // namespace detail
+
+/* take one unit of the running task's budget */
+inline void consume_budget()
+{
+    if (detail::coop_left && !--detail::coop_left) detail::coop_yield();
+}
+
+} // namespace coco
+
+#endif
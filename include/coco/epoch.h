@@ -0,0 +1,67 @@
+#ifndef _COCO_EPOCH_H_
+#define _COCO_EPOCH_H_
+
+#include "coco/preempt.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace coco {
+
+/* epoch-based reclamation for objects which are read without locks. readers
+ * enter a critical section with EpochGuard and objects unlinked from shared
+ * structures are retired, they are only freed after every thread which might
+ * still see them has left its critical section */
+class Epoch {
+public:
+    static Epoch& get_instance();
+
+    void enter();
+    void exit();
+
+    void retire(void* ptr, void (*deleter)(void*));
+    void reclaim();
+
+private:
+    struct ThreadRecord {
+        std::atomic<uint64_t> epoch; /* 0 if not in a critical section */
+        std::atomic<bool> in_use;
+        unsigned int nesting;
+        ThreadRecord* next;
+    };
+
+    struct RetiredObject {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    static const size_t RECLAIM_THRESHOLD = 64;
+
+    std::atomic<uint64_t> global_epoch;
+    std::atomic<ThreadRecord*> records;
+
+    PreemptMutex retire_mutex;
+    std::vector<RetiredObject> retired;
+
+    Epoch();
+
+    ThreadRecord* get_record();
+    ThreadRecord* acquire_record();
+    static void release_record(ThreadRecord* record);
+    bool try_advance(uint64_t epoch);
+};
+
+class EpochGuard {
+public:
+    EpochGuard() { Epoch::get_instance().enter(); }
+    ~EpochGuard() { Epoch::get_instance().exit(); }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+} // namespace coco
+
+#endif
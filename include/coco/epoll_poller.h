@@ -0,0 +1,25 @@
+#ifndef _COCO_EPOLL_POLLER_H_
+#define _COCO_EPOLL_POLLER_H_
+
+#include "coco/io_poller.h"
+
+namespace coco {
+
+class EpollPoller : public IOPoller {
+public:
+    EpollPoller(ThreadContext* parent);
+
+    Backend get_backend() const override { return Backend::EPOLL; }
+
+    bool add(int fd, PollEntry* entry) override;
+    void poll() override;
+
+private:
+    IOContext* io_ctx;
+
+    void wait_and_process(int timeout);
+};
+
+}; // namespace coco
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef _COCO_GROWABLE_STACK_H_
+#define _COCO_GROWABLE_STACK_H_
+
+namespace coco {
+
+/* reserve the whole stack of tasks spawned afterwards but only commit its
+ * top 16 KiB, a SIGSEGV handler commits more as the stack grows down into
+ * the rest. the stack size passed to go() is then the most a
+ * task may use, going past it hits the guard page and crashes instead of
+ * overwriting the heap. the handler runs on an alternate signal stack which
+ * every worker sets up in run(), so call this before run(). false if the
+ * handler can not be installed */
+bool enable_growable_stacks();
+/* tasks spawned afterwards get plain stacks again */
+void disable_growable_stacks();
+
+bool is_growable_stacks_enabled();
+
+} // namespace coco
+
+#endif
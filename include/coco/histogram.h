@@ -0,0 +1,171 @@
+#ifndef _COCO_HISTOGRAM_H_
+#define _COCO_HISTOGRAM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace coco {
+
+/* the non-empty buckets of a histogram, converted to nanoseconds */
+struct HistogramSnapshot {
+    struct Bucket {
+        uint64_t lower; /* inclusive */
+        uint64_t upper; /* exclusive */
+        uint64_t count;
+    };
+
+    std::vector<Bucket> buckets;
+    uint64_t count = 0;
+    uint64_t max = 0;
+
+    /* upper bound of the bucket holding the p-th percentile, p in [0, 100] */
+    uint64_t percentile(double p) const;
+};
+
+/* log-linear histogram of TSC cycle counts, every power of two is split
+ * into SUB_BUCKETS linear buckets so the relative error stays below
+ * 1 / SUB_BUCKETS. recording is a plain load and store without locked
+ * instructions, so a histogram has a single writer */
+class Histogram {
+public:
+    static const int SUB_BUCKET_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int NR_BUCKETS = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t cycles)
+    {
+        auto& bucket = buckets[get_bucket(cycles)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+
+        if (cycles > max.load(std::memory_order_relaxed)) {
+            max.store(cycles, std::memory_order_relaxed);
+        }
+    }
+
+    /* add the counts of other, which its writer may still be updating */
+    void merge(const Histogram& other);
+
+    HistogramSnapshot snapshot() const;
+
+private:
+    std::atomic<uint64_t> buckets[NR_BUCKETS] = {};
+    std::atomic<uint64_t> max{0};
+
+    static int get_bucket(uint64_t value)
+    {
+        if (value < SUB_BUCKETS) return value;
+
+        int exp = 63 - __builtin_clzll(value);
+        int sub = (value >> (exp - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+        return (exp - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t get_lower_bound(int bucket);
+};
+
+struct TaskClassStats;
+
+/* record the latency histograms of the task classes from now on, switching
+ * tasks skips them while disabled (the default) */
+void enable_latency_stats();
+void disable_latency_stats();
+
+bool is_latency_stats_enabled();
+
+/* tasks spawned with the same label share their histograms. looking a label
+ * up takes a lock, spawners on a hot path should get the class once and
+ * pass it to go() */
+class TaskClass {
+    friend std::vector<TaskClassStats> latency_stats();
+
+public:
+    static constexpr const char* DEFAULT_LABEL = "default";
+
+    /* auto sizing leaves a class alone until this many of its tasks have
+     * been measured, then hands out power of two stacks of at least
+     * STACK_HEADROOM times the deepest one and no smaller than MIN_STACK_SIZE
+     */
+    static const uint64_t STACK_MIN_SAMPLES = 8;
+    static const size_t STACK_HEADROOM = 2;
+    static const size_t MIN_STACK_SIZE = 16 * 1024;
+
+    /* every worker records into histograms of its own, added up by
+     * latency_stats(). workers beyond this many at once are not sampled */
+    static const int MAX_WORKER_SLOTS = 256;
+
+    struct WorkerHistograms {
+        /* from becoming runnable to running */
+        Histogram sched_delay;
+        /* from being switched to until switching away */
+        Histogram run_time;
+    };
+
+    /* -1 once all slots are taken */
+    static int acquire_worker_slot();
+    static void release_worker_slot(int slot);
+
+    /* the class of unlabeled tasks is returned for a null label */
+    static TaskClass* get(const char* label);
+
+    const std::string& get_label() const { return label; }
+
+    /* where the tasks of this class start, a labeled copy of the task entry
+     * trampoline once the perf map is enabled */
+    void* get_entry();
+
+    /* peak stack usage of a terminated task in bytes */
+    void record_stack_usage(size_t bytes);
+
+    /* stack size for a new task of the class which asked for requested bytes,
+     * never more than that */
+    size_t get_stack_size(size_t requested) const;
+
+    /* only the worker holding the slot may record into them */
+    WorkerHistograms& get_histograms(int slot)
+    {
+        auto* p = histograms[slot].load(std::memory_order_relaxed);
+        return p ? *p : create_histograms(slot);
+    }
+
+private:
+    std::string label;
+    std::atomic<void*> entry;
+    std::atomic<WorkerHistograms*> histograms[MAX_WORKER_SLOTS] = {};
+
+    std::atomic<uint64_t> stack_samples;
+    std::atomic<uint64_t> stack_total;
+    std::atomic<uint64_t> stack_peak;
+
+    explicit TaskClass(std::string label)
+        : label(std::move(label)), entry(nullptr), stack_samples(0),
+          stack_total(0), stack_peak(0)
+    {}
+
+    static TaskClass* lookup(const std::string& label);
+    WorkerHistograms& create_histograms(int slot);
+};
+
+struct TaskClassStats {
+    std::string label;
+    HistogramSnapshot sched_delay;
+    HistogramSnapshot run_time;
+
+    /* stack usage in bytes of the tasks measured by stack profiling */
+    uint64_t stack_samples = 0;
+    uint64_t stack_mean = 0;
+    uint64_t stack_peak = 0;
+};
+
+/* snapshot of the histograms and stack usage of all task classes seen so
+ * far */
+std::vector<TaskClassStats> latency_stats();
+
+} // namespace coco
+
+#endif
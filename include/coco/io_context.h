@@ -1,59 +1,207 @@
 #ifndef _COCO_IO_CONTEXT_H_
 #define _COCO_IO_CONTEXT_H_
 
+#include "coco/preempt.h"
+#include "coco/slab.h"
+
+#include <atomic>
+#include <cstdint>
 #include <memory>
-#include <shared_mutex>
-#include <unordered_map>
-#include <vector>
 
 namespace coco {
 
 class Task;
 class ThreadContext;
-
-struct PollEntry {
-    Task* task;
-    short* revents;
-
-    PollEntry(Task* task, short* revents) : task(task), revents(revents) {}
+struct IORequest;
+struct PollEntry;
+struct Waker;
+
+/* MSG_ZEROCOPY bookkeeping of a socket. the kernel numbers zero-copy sends
+ * in order and reports ranges of them as released on the error queue */
+struct ZeroCopyState {
+    PreemptMutex mutex; /* keeps our numbering in step with the kernel's */
+    bool enabled;
+    uint32_t next;      /* number of the next send */
+    uint32_t completed; /* sends numbered below this have been released */
+
+    ZeroCopyState() : enabled(false), next(0), completed(0) {}
 };
 
-class PollableFileDesc {
+class PollableFileDesc : public SlabObject {
 public:
-    PollableFileDesc(int fd) : fd(fd), events(0) {}
-
-    void add(short& new_events, Task* task, short* revents, short& old_events);
-    void notify(ThreadContext* thread, short& events, short& old_events);
+    PollableFileDesc(int fd, bool pollable, bool user_nonblock)
+        : refs(1), fd(fd), pollable(pollable), closed(false), ready(0),
+          user_nonblock(user_nonblock), fixed_file_rings(0), requests(nullptr),
+          in_list(nullptr), out_list(nullptr), in_out_list(nullptr),
+          err_list(nullptr)
+    {}
+
+    /* the fd table holds one reference, holders which outlive an
+     * EpochGuard (e.g. across parking) take their own */
+    void get() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void put()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    int get_fd() const { return fd; }
+
+    /* whether the fd is registered with the poller */
+    bool is_pollable() const { return pollable; }
+
+    /* whether the user asked for O_NONBLOCK, pollable fds are always
+     * non-blocking under the hood */
+    bool is_user_nonblock() const { return user_nonblock; }
+    void set_user_nonblock(bool nonblock) { user_nonblock = nonblock; }
+
+    /* io_uring instances which have the fd in their registered file table */
+    std::atomic<uint64_t>& get_fixed_file_rings() { return fixed_file_rings; }
+
+    /* returns false if the fd is already ready, entry->revents is set and the
+     * task is woken up right away in that case */
+    bool add(PollEntry* entry);
+    void remove(PollEntry* entry);
+    void notify(short events);
+    /* forget cached readiness, e.g. POLLERR once the error queue has been
+     * drained */
+    void clear_ready(short events);
+    void close();
+
+    /* operations submitted to the poller are tracked so that they can be
+     * cancelled when the fd is closed */
+    bool link_request(IORequest* req);
+    void unlink_request(IORequest* req);
+    bool is_closed();
+
+    /* created on the first zero-copy send */
+    ZeroCopyState* get_zerocopy();
 
 private:
-    std::mutex mutex;
+    PreemptMutex mutex;
+    std::atomic<int> refs;
 
     int fd;
-    short events;
-
-    using EntryList = std::vector<std::unique_ptr<PollEntry>>;
+    bool pollable;
+    bool closed;
+    /* edge-triggered readiness not yet consumed by any waiter */
+    short ready;
+    std::atomic<bool> user_nonblock;
+    std::atomic<uint64_t> fixed_file_rings;
+    IORequest* requests;
+    std::unique_ptr<ZeroCopyState> zerocopy;
+
+    using EntryList = PollEntry*;
     EntryList in_list;
     EntryList out_list;
     EntryList in_out_list;
     EntryList err_list;
 
-    void wake_up_list(ThreadContext* thread, EntryList PollableFileDesc::*list,
-                      short revents);
+    short wake_up_list(EntryList PollableFileDesc::*list, short check_events);
+};
+
+/* counted reference to a PollableFileDesc, only needed when the pointer is
+ * used outside of an EpochGuard */
+class PPFd {
+public:
+    PPFd() : pfd(nullptr) {}
+    explicit PPFd(PollableFileDesc* pfd) : pfd(pfd)
+    {
+        if (pfd) pfd->get();
+    }
+    PPFd(PPFd&& other) : pfd(other.pfd) { other.pfd = nullptr; }
+    ~PPFd()
+    {
+        if (pfd) pfd->put();
+    }
+
+    PPFd& operator=(PPFd&& other)
+    {
+        std::swap(pfd, other.pfd);
+        return *this;
+    }
+
+    PPFd(const PPFd&) = delete;
+    PPFd& operator=(const PPFd&) = delete;
+
+    PollableFileDesc* get() const { return pfd; }
+    PollableFileDesc* operator->() const { return pfd; }
+    explicit operator bool() const { return pfd != nullptr; }
+
+private:
+    PollableFileDesc* pfd;
 };
 
-using PPFd = std::shared_ptr<PollableFileDesc>;
+/* a task waiting for readiness on an fd. entries live in the waiter's stack
+ * frame and are linked into the wait lists of the fd */
+struct PollEntry {
+    ThreadContext* thread;
+    Task* task;
+    Waker* waker; /* woken instead of the task if set */
+    short events;
+    short revents;
+
+    PPFd pfd;
+    PollEntry** list; /* the wait list we are on, null if not queued */
+    PollEntry* prev;
+    PollEntry* next;
+
+    PollEntry()
+        : thread(nullptr), task(nullptr), waker(nullptr), events(0),
+          revents(0), list(nullptr), prev(nullptr), next(nullptr)
+    {}
+};
 
 class IOContext {
 public:
+    IOContext();
+
     static IOContext& get_instance();
 
-    void create_pfd(int fd);
-    PPFd get_pfd(int fd);
+    int get_epfd() const { return epfd; }
+
+    /* start tracking fd. fds created through the hooks replace whatever was
+     * left in the table, fds adopted later on keep an existing entry */
+    void create_pfd(int fd, bool replace = true);
+    void remove_pfd(int fd);
+
+    /* lock-free lookup, the result is only valid inside an EpochGuard */
+    PollableFileDesc* get_pfd(int fd)
+    {
+        auto* slot = get_slot(fd, false);
+        return slot ? slot->load(std::memory_order_acquire) : nullptr;
+    }
 
 private:
+    /* fds are small and dense so the table is indexed by fd directly. it
+     * grows a chunk at a time and chunks never move, so readers need no lock
+     */
+    static const int FD_CHUNK_SHIFT = 12;
+    static const int FD_CHUNK_SIZE = 1 << FD_CHUNK_SHIFT;
+    static const int MAX_FD_CHUNKS = 1 << 12;
+
+    struct FdChunk {
+        std::atomic<PollableFileDesc*> slots[FD_CHUNK_SIZE];
+    };
+
+    int epfd;
+    std::atomic<FdChunk*> fd_chunks[MAX_FD_CHUNKS];
+
+    std::atomic<PollableFileDesc*>* get_slot(int fd, bool create)
+    {
+        if (fd < 0 || (fd >> FD_CHUNK_SHIFT) >= MAX_FD_CHUNKS) return nullptr;
+
+        auto* chunk =
+            fd_chunks[fd >> FD_CHUNK_SHIFT].load(std::memory_order_acquire);
+        if (!chunk) {
+            if (!create) return nullptr;
+            chunk = alloc_chunk(fd >> FD_CHUNK_SHIFT);
+        }
+
+        return &chunk->slots[fd & (FD_CHUNK_SIZE - 1)];
+    }
+
+    FdChunk* alloc_chunk(int index);
     void close_pfd(PollableFileDesc* pfd);
-    std::unordered_map<int, PPFd> pfd_map;
-    std::shared_mutex pfd_mutex;
 };
 
 } // namespace coco
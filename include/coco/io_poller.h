@@ -4,23 +4,105 @@
 #include "coco/io_context.h"
 #include "coco/task.h"
 
+#include <sys/uio.h>
+
 namespace coco {
 
 class ThreadContext;
 
+/* an I/O operation handed to the poller to be performed asynchronously on
+ * behalf of a sleeping task */
+struct IORequest {
+    enum class Op {
+        READ,
+        WRITE,
+        READV,
+        WRITEV,
+        RECV,
+        SEND,
+        RECVMSG,
+        SENDMSG,
+        ACCEPT,
+    };
+
+    Op op;
+    PollableFileDesc* pfd;
+    void* addr;     /* buffer, iovec array, msghdr or sockaddr */
+    uint64_t len;   /* buffer length or iovec count */
+    uint64_t addr2; /* socklen_t* for accept */
+    int flags;      /* msg or accept flags */
+    int timeout;    /* in milliseconds, -1 to wait forever */
+
+    ThreadContext* thread;
+    Task* task;
+    int result; /* return value or negated errno */
+
+    /* backend scratch space which lives as long as the request */
+    int64_t scratch[2];
+
+    /* requests in flight on the same fd */
+    IORequest* prev;
+    IORequest* next;
+
+    IORequest(Op op, PollableFileDesc* pfd, void* addr, uint64_t len,
+              int flags = 0, int timeout = -1)
+        : op(op), pfd(pfd), addr(addr), len(len), addr2(0), flags(flags),
+          timeout(timeout), thread(nullptr), task(nullptr), result(0),
+          prev(nullptr), next(nullptr)
+    {}
+};
+
 class IOPoller {
 public:
-    IOPoller(ThreadContext* parent);
+    enum class Backend {
+        EPOLL,
+        IO_URING,
+    };
 
-    bool add(int fd, short events, Task* task, short* revents);
-    void poll();
+    IOPoller(ThreadContext* parent) : parent(parent) {}
+    virtual ~IOPoller() {}
 
-private:
-    ThreadContext* parent;
-    IOContext* io_ctx;
-    int epfd;
+    /* create the best poller supported by the system, io_uring is preferred
+     * unless COCO_IO_BACKEND=epoll is set in the environment */
+    static std::unique_ptr<IOPoller> create(ThreadContext* parent);
 
-    void wait_and_process(int timeout);
+    /* called when a hooked fd goes away so that backends can drop any
+     * per-fd state they keep */
+    static void release_fd(PollableFileDesc* pfd);
+
+    virtual Backend get_backend() const = 0;
+
+    /* queue a task waiting for readiness on fd, entry->task and
+     * entry->events are set by the caller. returns false if the fd can not
+     * be polled */
+    virtual bool add(int fd, PollEntry* entry) = 0;
+
+    /* whether operations can be handed to the backend with submit() */
+    virtual bool can_submit() const { return false; }
+
+    /* queue an operation on behalf of a task which should be sleeping, the
+     * task is woken up with req->result set on completion. returns false if
+     * the backend can not perform the operation */
+    virtual bool submit(Task* /* task */, IORequest* /* req */)
+    {
+        return false;
+    }
+
+    /* cancel a submitted operation, it completes with -ECANCELED */
+    virtual void cancel(IORequest* /* req */) {}
+
+    /* register buffers with the backend so that operations on them can avoid
+     * the per-call page mapping */
+    virtual bool register_buffers(const struct iovec* /* iov */,
+                                  unsigned /* nr */)
+    {
+        return false;
+    }
+
+    virtual void poll() = 0;
+
+protected:
+    ThreadContext* parent;
 };
 
 }; // namespace coco
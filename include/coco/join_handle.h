@@ -0,0 +1,287 @@
+#ifndef _COCO_JOIN_HANDLE_H_
+#define _COCO_JOIN_HANDLE_H_
+
+#include "coco/scheduler.h"
+#include "coco/sync/futex.h"
+#include "coco/sync/future.h"
+#include "coco/sync/spinlock.h"
+#include "coco/task.h"
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace coco {
+
+namespace detail {
+
+/* fired once by the first of the tasks a joiner waits for */
+struct JoinLatch {
+    std::atomic<uint8_t> fired{0};
+    Futex<uint8_t> futex;
+
+    void wait()
+    {
+        uint8_t pending = 0;
+        while (!fired.load(std::memory_order_acquire)) {
+            futex.wait(fired, pending);
+        }
+    }
+
+    void fire()
+    {
+        fired.store(1, std::memory_order_release);
+        futex.wake(SIZE_MAX);
+    }
+};
+
+/* lives on the joiner's stack, linked into the task while it waits */
+struct JoinWaiter {
+    JoinLatch* latch;
+    JoinWaiter* next;
+};
+
+/* the part of a joinable task which does not depend on its result */
+class JoinableTaskBase : public Task {
+public:
+    using Task::Task;
+
+    bool is_done() const { return done.load(std::memory_order_acquire); }
+
+    /* false if the task is done already */
+    bool add_waiter(JoinWaiter* waiter)
+    {
+        std::lock_guard<SpinLock> lock(join_lock);
+        if (is_done()) return false;
+
+        waiter->next = waiters;
+        waiters = waiter;
+        return true;
+    }
+
+    void remove_waiter(JoinWaiter* waiter)
+    {
+        std::lock_guard<SpinLock> lock(join_lock);
+        for (auto** p = &waiters; *p; p = &(*p)->next) {
+            if (*p == waiter) {
+                *p = waiter->next;
+                break;
+            }
+        }
+    }
+
+    void wait()
+    {
+        if (is_done()) return;
+
+        JoinLatch latch;
+        JoinWaiter waiter{&latch, nullptr};
+        if (!add_waiter(&waiter)) return;
+
+        latch.wait();
+        /* finish() may still be firing the latch which is about to go */
+        remove_waiter(&waiter);
+    }
+
+protected:
+    /* the exception escaped the task, it goes to the joiner instead of
+     * stopping the scheduler */
+    std::exception_ptr error;
+
+    void finish()
+    {
+        std::lock_guard<SpinLock> lock(join_lock);
+        done.store(true, std::memory_order_release);
+
+        for (auto* w = waiters; w; w = w->next) {
+            w->latch->fire();
+        }
+        waiters = nullptr;
+    }
+
+private:
+    SpinLock join_lock;
+    std::atomic<bool> done{false};
+    JoinWaiter* waiters = nullptr;
+};
+
+/* the result is kept inline in the task block, which the join handle holds
+ * on to after the scheduler has let go of it */
+template <typename T> class JoinableTask : public JoinableTaskBase {
+public:
+    using Value = std::conditional_t<std::is_void_v<T>, Unit, T>;
+
+    template <typename F>
+    JoinableTask(F&& fn, size_t stacksize, TaskClass* task_class)
+        : JoinableTaskBase(
+              [this, fn = std::forward<F>(fn)]() mutable {
+                  try {
+                      if constexpr (std::is_void_v<T>) {
+                          fn();
+                          result.emplace();
+                      } else {
+                          result.emplace(fn());
+                      }
+                  } catch (...) {
+                      error = std::current_exception();
+                  }
+                  finish();
+              },
+              stacksize, task_class)
+    {}
+
+    T take()
+    {
+        if (error) std::rethrow_exception(error);
+        if constexpr (!std::is_void_v<T>) return std::move(*result);
+    }
+
+private:
+    std::optional<Value> result;
+};
+
+} // namespace detail
+
+template <typename T> class JoinHandle {
+public:
+    JoinHandle() : task(nullptr) {}
+    explicit JoinHandle(detail::JoinableTask<T>* task) : task(task)
+    {
+        task->get();
+    }
+
+    JoinHandle(JoinHandle&& other) : task(other.task) { other.task = nullptr; }
+    JoinHandle& operator=(JoinHandle&& other)
+    {
+        std::swap(task, other.task);
+        return *this;
+    }
+
+    /* dropping the handle detaches the task */
+    ~JoinHandle()
+    {
+        if (task) task->put();
+    }
+
+    bool valid() const { return task; }
+    bool is_ready() const { return task->is_done(); }
+    uint64_t get_id() const { return task->get_id(); }
+
+    /* parks the calling task until the task returns */
+    void wait() const { task->wait(); }
+
+    /* the task's return value or the exception it threw, only once */
+    T get()
+    {
+        JoinHandle handle(std::move(*this));
+        handle.wait();
+        return handle.task->take();
+    }
+
+private:
+    template <typename U>
+    friend size_t when_any(std::vector<JoinHandle<U>>& handles);
+
+    detail::JoinableTask<T>* task;
+};
+
+/* like go() but the result can be waited for. an exception thrown by the
+ * task is rethrown by get() instead of stopping the scheduler */
+template <typename F>
+auto spawn(const char* label, F&& fn, size_t stacksize = 1 * 1024 * 1024)
+    -> JoinHandle<std::invoke_result_t<F>>
+{
+    using T = std::invoke_result_t<F>;
+
+    auto* task = new detail::JoinableTask<T>(std::forward<F>(fn), stacksize,
+                                             TaskClass::get(label));
+    JoinHandle<T> handle(task);
+
+    auto* sched = Scheduler::get_current();
+    (sched ? *sched : Scheduler::get_instance()).go(TaskPtr(task));
+
+    return handle;
+}
+
+template <typename F>
+auto spawn(F&& fn, size_t stacksize = 1 * 1024 * 1024)
+    -> JoinHandle<std::invoke_result_t<F>>
+{
+    return spawn(nullptr, std::forward<F>(fn), stacksize);
+}
+
+/* join all of the tasks. the first exception is rethrown once every task has
+ * returned */
+template <typename T>
+auto when_all(std::vector<JoinHandle<T>>& handles)
+    -> std::conditional_t<std::is_void_v<T>, void, std::vector<T>>
+{
+    for (auto& handle : handles) {
+        handle.wait();
+    }
+
+    std::exception_ptr eptr;
+    if constexpr (std::is_void_v<T>) {
+        for (auto& handle : handles) {
+            try {
+                handle.get();
+            } catch (...) {
+                if (!eptr) eptr = std::current_exception();
+            }
+        }
+        if (eptr) std::rethrow_exception(eptr);
+    } else {
+        std::vector<T> results;
+        results.reserve(handles.size());
+        for (auto& handle : handles) {
+            try {
+                results.push_back(handle.get());
+            } catch (...) {
+                if (!eptr) eptr = std::current_exception();
+            }
+        }
+        if (eptr) std::rethrow_exception(eptr);
+        return results;
+    }
+}
+
+/* park until one of the tasks returns and give its index, the handles stay
+ * valid */
+template <typename T> size_t when_any(std::vector<JoinHandle<T>>& handles)
+{
+    if (handles.empty()) {
+        throw std::invalid_argument("when_any() needs at least one task");
+    }
+
+    detail::JoinLatch latch;
+    std::vector<detail::JoinWaiter> waiters(handles.size(), {&latch, nullptr});
+
+    size_t added = 0;
+    for (; added < handles.size(); added++) {
+        if (!handles[added].task->add_waiter(&waiters[added])) {
+            latch.fired.store(1, std::memory_order_relaxed);
+            break;
+        }
+    }
+
+    latch.wait();
+
+    /* the latch goes away with this frame */
+    for (size_t i = 0; i < added; i++) {
+        handles[i].task->remove_waiter(&waiters[i]);
+    }
+
+    for (size_t i = 0; i < handles.size(); i++) {
+        if (handles[i].is_ready()) return i;
+    }
+    return 0;
+}
+
+} // namespace coco
+
+#endif
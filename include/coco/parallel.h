@@ -0,0 +1,194 @@
+#ifndef _COCO_PARALLEL_H_
+#define _COCO_PARALLEL_H_
+
+#include "coco/join_handle.h"
+#include "coco/scheduler.h"
+#include "coco/thread_context.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace coco {
+
+/* fork-join loops on the workers of the calling task's scheduler. the range
+ * is split in halves down to grain indices, the upper half of every split
+ * becomes a task which idle workers steal while the caller goes on with the
+ * lower half, and the caller parks at the joins so its worker runs what was
+ * not stolen. no threads are added. a grain of 0 picks one which gives every
+ * worker a few chunks. outside of tasks the loops run inline. an exception
+ * skips the chunks which have not started and is rethrown once the others
+ * are done. the forked halves run on stacks of PARALLEL_STACK_SIZE */
+
+namespace detail {
+
+/* a loop forks about log2(n / grain) tasks at a time, most of which only
+ * split the range again */
+const size_t PARALLEL_STACK_SIZE = 256 * 1024;
+
+inline size_t get_grain(size_t n, size_t grain)
+{
+    if (grain) return grain;
+
+    auto* sched = Scheduler::get_current();
+    size_t chunks = 4 * (sched ? sched->get_nr_threads() : 1);
+    return std::max<size_t>(1, (n + chunks - 1) / chunks);
+}
+
+/* run the upper half as a task while the caller runs the lower half, the
+ * task holds on to lower and upper until it is joined */
+template <typename L, typename U> auto fork_join(L&& lower, U&& upper)
+{
+    auto handle =
+        spawn("coco::parallel", std::forward<U>(upper), PARALLEL_STACK_SIZE);
+    Scheduler::get_current()->notify_idle();
+
+    /* parking inside a catch block would leave the exception behind on the
+     * thread the task moves away from */
+    using T = std::invoke_result_t<L>;
+    using Value = std::conditional_t<std::is_void_v<T>, Unit, T>;
+    std::optional<Value> lower_value;
+    std::exception_ptr eptr;
+    try {
+        if constexpr (std::is_void_v<T>) {
+            lower();
+            lower_value.emplace();
+        } else {
+            lower_value.emplace(lower());
+        }
+    } catch (...) {
+        eptr = std::current_exception();
+    }
+
+    if (eptr) {
+        handle.wait();
+        std::rethrow_exception(eptr);
+    }
+
+    if constexpr (std::is_void_v<T>) {
+        handle.get();
+    } else {
+        return std::make_pair(std::move(*lower_value), handle.get());
+    }
+}
+
+template <typename F>
+void parallel_for_range(size_t begin, size_t end, size_t grain, F& fn,
+                        std::atomic<bool>& failed)
+{
+    if (end - begin <= grain) {
+        try {
+            for (size_t i = begin; i < end; i++) {
+                if (failed.load(std::memory_order_relaxed)) return;
+                fn(i);
+            }
+        } catch (...) {
+            failed.store(true, std::memory_order_relaxed);
+            throw;
+        }
+        return;
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+    fork_join([&] { parallel_for_range(begin, mid, grain, fn, failed); },
+              [&] { parallel_for_range(mid, end, grain, fn, failed); });
+}
+
+template <typename T, typename M, typename R>
+T parallel_reduce_range(size_t begin, size_t end, size_t grain,
+                        const T& identity, M& map, R& reduce,
+                        std::atomic<bool>& failed)
+{
+    if (end - begin <= grain) {
+        T acc = identity;
+        try {
+            for (size_t i = begin; i < end; i++) {
+                if (failed.load(std::memory_order_relaxed)) break;
+                acc = reduce(std::move(acc), map(i));
+            }
+        } catch (...) {
+            failed.store(true, std::memory_order_relaxed);
+            throw;
+        }
+        return acc;
+    }
+
+    size_t mid = begin + (end - begin) / 2;
+    auto halves = fork_join(
+        [&] {
+            return parallel_reduce_range(begin, mid, grain, identity, map,
+                                         reduce, failed);
+        },
+        [&] {
+            return parallel_reduce_range(mid, end, grain, identity, map,
+                                         reduce, failed);
+        });
+    return reduce(std::move(halves.first), std::move(halves.second));
+}
+
+} // namespace detail
+
+/* fn(i) for every i in [begin, end) */
+template <typename F>
+void parallel_for(size_t begin, size_t end, F&& fn, size_t grain = 0)
+{
+    if (begin >= end) return;
+
+    if (!ThreadContext::get_current_task()) {
+        for (size_t i = begin; i < end; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::atomic<bool> failed{false};
+    detail::parallel_for_range(begin, end,
+                               detail::get_grain(end - begin, grain), fn,
+                               failed);
+}
+
+/* reduce(...reduce(reduce(identity, map(begin)), map(begin + 1))...) with
+ * the chunks folded from identity and combined in index order, so reduce
+ * has to be associative but need not be commutative */
+template <typename T, typename M, typename R>
+T parallel_reduce(size_t begin, size_t end, T identity, M&& map, R&& reduce,
+                  size_t grain = 0)
+{
+    if (!ThreadContext::get_current_task()) {
+        for (size_t i = begin; i < end; i++) {
+            identity = reduce(std::move(identity), map(i));
+        }
+        return identity;
+    }
+
+    if (begin >= end) return identity;
+
+    std::atomic<bool> failed{false};
+    return detail::parallel_reduce_range(
+        begin, end, detail::get_grain(end - begin, grain), identity, map,
+        reduce, failed);
+}
+
+/* run the functions in parallel and return once all of them have */
+template <typename F> void parallel_invoke(F&& fn) { fn(); }
+
+template <typename F, typename... Fs>
+void parallel_invoke(F&& fn, Fs&&... fns)
+{
+    if (!ThreadContext::get_current_task()) {
+        fn();
+        parallel_invoke(std::forward<Fs>(fns)...);
+        return;
+    }
+
+    detail::fork_join([&] { fn(); },
+                      [&] { parallel_invoke(std::forward<Fs>(fns)...); });
+}
+
+} // namespace coco
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _COCO_PERF_MAP_H_
+#define _COCO_PERF_MAP_H_
+
+#include <string>
+
+namespace coco {
+
+/* give every task label its own copy of the task entry trampoline and list
+ * the copies in /tmp/perf-<pid>.map. the root frame of a task's stack then
+ * shows up as coco_task[label] in perf and other profilers which read perf
+ * maps. only tasks spawned afterwards are affected.
+ *
+ * the copies sit on anonymous pages without unwind info, the CFI of
+ * coco_task_entry does not carry over to them. frame pointer unwinders
+ * still stop at the root frame it clears, DWARF unwinders give up there for
+ * want of an FDE */
+void enable_perf_map();
+/* close the map, it is left in /tmp for perf to read. labels seen from now
+ * on keep the shared trampoline */
+void disable_perf_map();
+bool is_perf_map_enabled();
+
+/* returns nullptr if the copy can not be made */
+void* create_labeled_entry(const std::string& label);
+
+} // namespace coco
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef _COCO_PREEMPT_H_
+#define _COCO_PREEMPT_H_
+
+#include <atomic>
+#include <mutex>
+
+namespace coco {
+
+namespace detail {
+/* non-zero while the thread is inside the scheduler or holds one of its
+ * locks, asynchronous preemption leaves the task alone then */
+inline thread_local unsigned int preempt_off = 0;
+} // namespace detail
+
+/* the fences keep the compiler from moving the counter past the code it
+ * guards, the signal handler runs on the same thread */
+inline void preempt_disable()
+{
+    detail::preempt_off++;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+inline void preempt_enable()
+{
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    detail::preempt_off--;
+}
+
+/* std::mutex for the library's own short critical sections which tasks
+ * enter. a task preempted while holding one would block every other task
+ * taking it, its own worker included */
+class PreemptMutex {
+public:
+    void lock()
+    {
+        preempt_disable();
+        mutex.lock();
+    }
+
+    bool try_lock()
+    {
+        preempt_disable();
+        if (mutex.try_lock()) return true;
+        preempt_enable();
+        return false;
+    }
+
+    void unlock()
+    {
+        mutex.unlock();
+        preempt_enable();
+    }
+
+private:
+    std::mutex mutex;
+};
+
+} // namespace coco
+
+#endif
@@ -1,32 +1,141 @@
 #ifndef _COCO_SCHEDULER_H_
 #define _COCO_SCHEDULER_H_
 
+#include "coco/preempt.h"
+#include "coco/stats.h"
 #include "coco/task.h"
 #include "coco/thread_context.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <csignal>
+#include <functional>
+#include <mutex>
+#include <ostream>
 #include <thread>
+#include <vector>
 
 namespace coco {
 
 class Scheduler {
 public:
     explicit Scheduler(int nr_threads = 1, uint64_t monitor_tick_us = 10000);
+    ~Scheduler();
 
+    /* the default scheduler of coco::go() and coco::run() */
     static Scheduler& get_instance();
+    /* the scheduler of the calling task, nullptr outside of tasks */
+    static Scheduler* get_current();
 
-    void go(std::function<void()>&& fn, size_t stacksize);
+    /* may be called from tasks of other schedulers and from other threads */
+    void go(std::function<void()>&& fn, size_t stacksize,
+            TaskClass* task_class = nullptr);
+    void go(std::function<void()>&& fn, size_t stacksize, const char* label);
+    void go(TaskPtr task);
 
+    /* runs until every task spawned so far has returned. the thread the
+     * last one returns on stops the scheduler right away */
     void run();
     void stop();
 
+    /* keep the worker threads parked between runs instead of starting them
+     * over for every run(), until shutdown() */
+    void set_persistent(bool persistent) { this->persistent = persistent; }
+    /* join the workers, tasks which have not returned are dropped */
+    void shutdown();
+
+    /* pin worker i to cpus[i % cpus.size()] and the monitor to all of them,
+     * the thread calling run() is worker 0 for the duration of the run.
+     * takes effect when the workers are started */
+    void set_affinity(std::vector<int> cpus) { this->cpus = std::move(cpus); }
+
+    int get_nr_threads() const { return nr_threads; }
+
+    /* move half of the run queue of the busiest other worker over to thief,
+     * called by workers before they go idle. false if there was nothing to
+     * take */
+    bool steal_work(ThreadContext* thief);
+    /* wake a parked worker so that it comes to steal the tasks just queued
+     * instead of waiting for the monitor to hand them out */
+    void notify_idle();
+
+    /* spawned and not yet returned */
+    size_t get_live_tasks() const
+    {
+        return live_tasks.load(std::memory_order_acquire);
+    }
+    /* count something other than a Task as live until it calls
+     * task_exited(), e.g. a stackless coroutine */
+    void task_started() { live_tasks.fetch_add(1, std::memory_order_relaxed); }
+    /* called by the thread a task returns on */
+    void task_exited();
+
+    /* the worker go() queues onto from the calling thread */
+    ThreadContext* get_spawn_thread();
+
+    /* aggregate the per-worker counters, only valid while running */
+    SchedulerStats stats();
+
+    /* count tasks which run for longer than slice_us without switching in
+     * WorkerStats::long_slices, 0 turns the watchdog off. with preempt set
+     * they are also interrupted with signo and made to yield, see
+     * ThreadContext::enable_preemption(). returns false if preemption is not
+     * supported */
+    bool set_watchdog(uint64_t slice_us, bool preempt = false,
+                      int signo = SIGURG);
+
+    /* called by the monitor thread once for every long slice, with the task,
+     * the worker it runs on and how long it has been running so far */
+    using SliceHandler = void (*)(uint64_t task_id, size_t tid,
+                                  uint64_t running_ns);
+    void set_slice_handler(SliceHandler handler)
+    {
+        slice_handler.store(handler, std::memory_order_relaxed);
+    }
+
+    void dump_tasks(std::ostream& os);
+    /* the monitor dumps the tasks to stderr whenever signo is received */
+    static void enable_dump_signal(int signo);
+
 private:
     int nr_threads;
     uint64_t monitor_tick_us;
-    bool stopped;
+    std::atomic<bool> stopped;
     std::exception_ptr eptr;
+    std::atomic<size_t> live_tasks;
+    /* created up front and never changed, read without locking */
     std::vector<std::unique_ptr<ThreadContext>> threads;
+    /* taken by go() from outside and by shutdown() */
+    PreemptMutex remote_mutex;
+    std::vector<int> cpus;
+
+    /* the workers other than the calling thread plus the monitor. they wait
+     * for run_generation to move on and count down busy_workers when done */
+    bool persistent;
+    std::vector<std::thread> pool_threads;
+    std::mutex pool_mutex;
+    std::condition_variable pool_cv;
+    uint64_t run_generation;
+    size_t busy_workers;
+    bool pool_shutdown;
+
+    std::atomic<uint64_t> watchdog_slice_us;
+    std::atomic<bool> watchdog_preempt;
+    std::atomic<SliceHandler> slice_handler;
+
+    /* the monitor sleeps on it between ticks so that stop() ends it early */
+    std::mutex monitor_mutex;
+    std::condition_variable monitor_cv;
+
+    static std::atomic<bool> dump_requested;
 
+    static void handle_dump_signal(int signo);
+    void check_slices();
     void monitor_thread_func();
+    void start_workers();
+    void stop_workers();
+    void pool_thread_func(uint64_t generation,
+                          const std::function<void()>& body);
 };
 
 } // namespace coco
@@ -0,0 +1,66 @@
+#ifndef _COCO_SLAB_H_
+#define _COCO_SLAB_H_
+
+#include <cstddef>
+#include <new>
+
+namespace coco {
+
+/* small object allocator for runtime control blocks and short-lived task
+ * objects. every thread carves objects of a size class out of 64 KiB slabs
+ * it owns and frees them without locks, objects freed by other threads go
+ * through a lock-free list of their slab which the owner picks up when it
+ * runs dry. sizes above SLAB_MAX_SIZE go to operator new. the size has to be
+ * passed back on free */
+const size_t SLAB_MAX_SIZE = 2048;
+const size_t SLAB_ALIGN = 16;
+
+void* slab_alloc(size_t size);
+void slab_free(void* p, size_t size);
+
+/* classes deriving from it are allocated from the slabs by new */
+struct SlabObject {
+    static void* operator new(size_t size) { return slab_alloc(size); }
+    static void operator delete(void* p, size_t size) { slab_free(p, size); }
+};
+
+/* std allocator on top of the slabs, e.g. for containers and
+ * std::allocate_shared() inside tasks */
+template <typename T> class SlabAllocator {
+public:
+    using value_type = T;
+
+    SlabAllocator() noexcept = default;
+    template <typename U> SlabAllocator(const SlabAllocator<U>&) noexcept {}
+
+    T* allocate(size_t n)
+    {
+        if (alignof(T) > SLAB_ALIGN) {
+            return (T*)::operator new(n * sizeof(T),
+                                      std::align_val_t(alignof(T)));
+        }
+        return (T*)slab_alloc(n * sizeof(T));
+    }
+
+    void deallocate(T* p, size_t n) noexcept
+    {
+        if (alignof(T) > SLAB_ALIGN) {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+            return;
+        }
+        slab_free(p, n * sizeof(T));
+    }
+
+    template <typename U> bool operator==(const SlabAllocator<U>&) const
+    {
+        return true;
+    }
+    template <typename U> bool operator!=(const SlabAllocator<U>&) const
+    {
+        return false;
+    }
+};
+
+} // namespace coco
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef _COCO_STACK_PROFILE_H_
+#define _COCO_STACK_PROFILE_H_
+
+namespace coco {
+
+/* fill the stacks of tasks spawned afterwards with a known pattern and
+ * measure how deep each one got once it terminates. the peaks are kept per
+ * task label, see latency_stats(). with auto_size a new task gets the
+ * smallest stack size class that covers the peak of its label plus headroom
+ * instead of the size asked for */
+void enable_stack_profiling(bool auto_size = false);
+void disable_stack_profiling();
+
+bool is_stack_painting_enabled();
+bool is_stack_auto_sizing_enabled();
+
+} // namespace coco
+
+#endif
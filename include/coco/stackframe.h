@@ -5,20 +5,45 @@ namespace coco {
 
 typedef unsigned long reg_t;
 
+class Task;
+
+/* what coco_switch_context() leaves at the saved stack pointer of a task
+ * which is switched away from, lowest address first */
 struct StackFrame {
-    /* first argument */
+    /* first argument, only used to hand the task to its entry */
     reg_t rdi;
     /* callee-saved registers */
     reg_t r15;
     reg_t r14;
     reg_t r13;
-    reg_t r12;
+    reg_t r12; /* function called by the entry trampoline */
     reg_t rbp;
     reg_t rbx;
-    /* stack pointer */
-    reg_t rsp;
+    /* return address */
+    reg_t rip;
 } __attribute__((packed));
 
 } // namespace coco
 
+/* save the callee-saved registers on the current stack, store the stack
+ * pointer to *prev_sp and resume the context saved at *next_sp, which is
+ * read after the store so that a task can switch to itself. returns the prev
+ * argument of the switch which resumes us */
+extern "C" coco::Task* coco_switch_context(coco::Task* prev,
+                                           coco::reg_t* prev_sp,
+                                           coco::reg_t* next_sp);
+
+/* root frame of every task, calls r12 with the task in rdi. it has no
+ * caller as far as unwinders are concerned */
+extern "C" void coco_task_entry();
+extern "C" const char coco_task_entry_end[];
+
+/* where a preempted task is sent, see ThreadContext::enable_preemption().
+ * saves the interrupted context including the extended state of
+ * coco_xsave_size bytes, calls coco_preempt() and resumes the interrupted
+ * code */
+extern "C" void coco_async_preempt();
+extern "C" unsigned long coco_xsave_size;
+extern "C" void coco_preempt();
+
 #endif
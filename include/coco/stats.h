@@ -0,0 +1,123 @@
+#ifndef _COCO_STATS_H_
+#define _COCO_STATS_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace coco {
+
+/* snapshot of one worker thread */
+struct WorkerStats {
+    size_t tid = 0;
+
+    uint64_t context_switches = 0;
+    uint64_t spawns = 0;
+    uint64_t local_wakes = 0;  /* woken up by the worker itself */
+    uint64_t remote_wakes = 0; /* woken up by other threads */
+    uint64_t steals_in = 0;
+    uint64_t steals_out = 0;
+    uint64_t parks = 0;
+    uint64_t idle_ns = 0;
+    uint64_t epoll_waits = 0;
+    uint64_t io_events = 0; /* readiness events and io completions */
+    uint64_t long_slices = 0; /* caught by the watchdog */
+    uint64_t preemptions = 0;
+    uint64_t coop_yields = 0; /* forced by the budget, see coop.h */
+
+    uint64_t runnable_tasks = 0;
+    uint64_t sleeping_tasks = 0;
+    uint64_t zombie_tasks = 0;
+
+    /* stacks are charged to the worker which queued the task and credited
+     * back by the one which frees it, only the total is meaningful. plain
+     * stacks are zero-filled on allocation so all of them is committed,
+     * growable ones are charged as they grow */
+    int64_t stack_reserved = 0;
+    int64_t stack_committed = 0;
+
+    WorkerStats& operator+=(const WorkerStats& other);
+};
+
+struct SchedulerStats {
+    WorkerStats total; /* total.tid is the number of workers */
+    uint64_t live_tasks = 0; /* spawned and not yet returned */
+    std::vector<WorkerStats> workers;
+};
+
+/* the per-worker counters. the ones only the owning thread bumps share a
+ * cache line and are updated without locked instructions, the ones other
+ * threads (the monitor or wakers) touch live on a line of their own */
+class StatsCounters {
+public:
+    class LocalCounter {
+    public:
+        void add(uint64_t n = 1)
+        {
+            value.store(value.load(std::memory_order_relaxed) + n,
+                        std::memory_order_relaxed);
+        }
+        uint64_t get() const { return value.load(std::memory_order_relaxed); }
+        void reset() { value.store(0, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value{0};
+    };
+
+    class SharedCounter {
+    public:
+        void add(uint64_t n = 1)
+        {
+            value.fetch_add(n, std::memory_order_relaxed);
+        }
+        uint64_t get() const { return value.load(std::memory_order_relaxed); }
+        void reset() { value.store(0, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value{0};
+    };
+
+    struct alignas(64) {
+        LocalCounter context_switches;
+        LocalCounter local_wakes;
+        LocalCounter parks;
+        LocalCounter idle_ns;
+        LocalCounter preemptions;
+        LocalCounter coop_yields;
+    } local;
+
+    struct alignas(64) {
+        SharedCounter spawns;
+        SharedCounter remote_wakes;
+        SharedCounter steals_in;
+        SharedCounter steals_out;
+        SharedCounter epoll_waits;
+        SharedCounter io_events;
+        SharedCounter long_slices;
+        SharedCounter stack_allocated;
+        SharedCounter stack_freed;
+        SharedCounter stack_committed;
+        SharedCounter stack_released;
+    } shared;
+
+    void fill(WorkerStats& stats) const;
+    /* start over for the next run */
+    void reset();
+
+    /* count a long slice the first time the monitor sees it */
+    bool flag_slice(uint64_t start)
+    {
+        if (flagged_slice == start) return false;
+        flagged_slice = start;
+        shared.long_slices.add();
+        return true;
+    }
+
+private:
+    uint64_t flagged_slice = 0; /* only touched by the monitor */
+};
+
+} // namespace coco
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _COCO_STREAM_H_
+#define _COCO_STREAM_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace coco {
+
+/* buffered reader/writer over a hooked fd. reads are served from a ring
+ * buffer which is refilled with a single readv(), small writes are coalesced
+ * and go out in one syscall when the stream is flushed, when the buffer is
+ * full or before the stream has to wait for input. the calling task is
+ * parked whenever the fd would block. the stream does not own the fd */
+class Stream {
+public:
+    static const size_t DEFAULT_BUFFER_SIZE = 16 * 1024;
+
+    /* the read buffer size is rounded up to a power of two */
+    explicit Stream(int fd, size_t read_buffer_size = DEFAULT_BUFFER_SIZE,
+                    size_t write_buffer_size = DEFAULT_BUFFER_SIZE);
+    ~Stream();
+
+    Stream(const Stream&) = delete;
+    Stream& operator=(const Stream&) = delete;
+
+    int get_fd() const { return fd; }
+
+    /* bytes which can be read without touching the fd */
+    size_t available() const { return rtail - rhead; }
+
+    /* read whatever is available, up to len bytes. returns 0 at EOF */
+    ssize_t read(void* buf, size_t len);
+    /* read exactly len bytes, less only if EOF is reached */
+    ssize_t read_exact(void* buf, size_t len);
+    /* read up to and including delim into line, which is replaced. returns
+     * the length of line, which lacks the delimiter at EOF */
+    ssize_t read_until(char delim, std::string& line);
+    /* wait until len bytes are buffered and copy them without consuming,
+     * e.g. to look at a length header. len must fit in the read buffer */
+    ssize_t peek(void* buf, size_t len);
+
+    /* returns len, or a short count if the fd fails after part of the data
+     * has been written, like write(2) */
+    ssize_t write(const void* buf, size_t len);
+    ssize_t writev(const struct iovec* iov, int iovcnt);
+    /* returns 0 once everything buffered has been written. on failure what
+     * has been written is no longer pending */
+    int flush();
+
+    size_t pending() const { return wend - wstart; }
+
+private:
+    int fd;
+
+    std::unique_ptr<char[]> rbuf;
+    size_t rcap;
+    size_t rhead; /* free-running, masked with rcap - 1 */
+    size_t rtail;
+
+    std::unique_ptr<char[]> wbuf;
+    size_t wcap;
+    size_t wstart;
+    size_t wend;
+
+    ssize_t fill();
+    void copy_out(void* buf, size_t len, bool consume);
+
+    /* total is what has been written, also when it fails */
+    int write_all(struct iovec* iov, int iovcnt, size_t& total);
+};
+
+} // namespace coco
+
+#endif
@@ -2,6 +2,7 @@
 #define _COCO_SYNC_H_
 
 #include "coco/sync/condition_variable.h"
+#include "coco/sync/future.h"
 #include "coco/sync/mutex.h"
 #include "coco/sync/shared_mutex.h"
 #include "coco/sync/spinlock.h"
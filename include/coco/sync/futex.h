@@ -1,9 +1,13 @@
 #ifndef _COCO_FUTEX_H_
 #define _COCO_FUTEX_H_
 
+#include "coco/slab.h"
 #include "coco/thread_context.h"
 
 #include <atomic>
+#include <deque>
+#include <memory>
+#include <queue>
 
 namespace coco {
 
@@ -27,7 +31,7 @@ public:
             return;
         }
 
-        ThreadContext::set_sleep();
+        ThreadContext::set_sleep(ParkReason::FUTEX, (uint64_t)&uval);
         wait_queue.push(std::make_unique<WaitEntry>(
             ThreadContext::get_current_thread(), task));
         queue_lock.unlock();
@@ -35,6 +39,24 @@ public:
         ThreadContext::yield();
     }
 
+    /* like wait() but queue waker instead of parking the calling task.
+     * false if uval has changed already and waker is not queued */
+    bool wait(std::atomic<T>& uval, T old_val, Waker* waker)
+    {
+        queue_lock.lock();
+
+        if (uval.load(std::memory_order_relaxed) != old_val) {
+            queue_lock.unlock();
+
+            return false;
+        }
+
+        wait_queue.push(std::make_unique<WaitEntry>(nullptr, nullptr, waker));
+        queue_lock.unlock();
+
+        return true;
+    }
+
     void wake(size_t task_count)
     {
         size_t count = 0;
@@ -45,7 +67,11 @@ public:
             auto entry = std::move(wait_queue.front());
             wait_queue.pop();
 
-            entry->thread->wake_up(entry->task);
+            if (entry->waker) {
+                entry->waker->wake(entry->waker);
+            } else {
+                entry->thread->wake_up(entry->task);
+            }
 
             if (++count >= task_count) break;
         }
@@ -54,16 +80,20 @@ public:
     }
 
 private:
-    struct WaitEntry {
+    struct WaitEntry : public SlabObject {
         ThreadContext* thread;
         Task* task;
+        Waker* waker;
 
-        WaitEntry(ThreadContext* thread, Task* task)
-            : thread(thread), task(task)
+        WaitEntry(ThreadContext* thread, Task* task, Waker* waker = nullptr)
+            : thread(thread), task(task), waker(waker)
         {}
     };
 
-    std::queue<std::unique_ptr<WaitEntry>> wait_queue;
+    using WaitEntryPtr = std::unique_ptr<WaitEntry>;
+    std::queue<WaitEntryPtr,
+               std::deque<WaitEntryPtr, SlabAllocator<WaitEntryPtr>>>
+        wait_queue;
     coco::SpinLock queue_lock;
 };
 
@@ -0,0 +1,130 @@
+#ifndef _COCO_FUTURE_H_
+#define _COCO_FUTURE_H_
+
+#include "coco/slab.h"
+#include "coco/sync/futex.h"
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace coco {
+
+namespace detail {
+
+/* where a promise leaves its result, waiters park on the futex until it is
+ * ready so the promise may be fulfilled from any thread of any scheduler */
+template <typename T> struct FutureState {
+    std::atomic<uint8_t> ready{0};
+    Futex<uint8_t> waiters;
+    std::optional<T> value;
+    std::exception_ptr eptr;
+
+    void wait()
+    {
+        uint8_t pending = 0;
+        while (!ready.load(std::memory_order_acquire)) {
+            waiters.wait(ready, pending);
+        }
+    }
+
+    void set_ready()
+    {
+        ready.store(1, std::memory_order_release);
+        waiters.wake(SIZE_MAX);
+    }
+};
+
+/* stands in for the value of void results */
+struct Unit {};
+
+template <typename T> class FutureAwaiter;
+
+} // namespace detail
+
+template <typename T> class Promise;
+
+template <typename T> class Future {
+public:
+    Future() = default;
+
+    bool valid() const { return (bool)state; }
+    bool is_ready() const
+    {
+        return state->ready.load(std::memory_order_acquire);
+    }
+
+    /* parks the calling task until the promise is fulfilled */
+    void wait() const { state->wait(); }
+
+    /* the value or the exception the promise was fulfilled with, only once */
+    T get()
+    {
+        auto s = std::move(state);
+        s->wait();
+        if (s->eptr) std::rethrow_exception(s->eptr);
+
+        if constexpr (!std::is_void_v<T>) return std::move(*s->value);
+    }
+
+private:
+    friend class Promise<T>;
+    friend class detail::FutureAwaiter<T>;
+    using Value = std::conditional_t<std::is_void_v<T>, detail::Unit, T>;
+
+    std::shared_ptr<detail::FutureState<Value>> state;
+
+    explicit Future(std::shared_ptr<detail::FutureState<Value>> state)
+        : state(std::move(state))
+    {}
+};
+
+template <typename T> class Promise {
+public:
+    Promise()
+        : state(std::allocate_shared<detail::FutureState<Value>>(
+              SlabAllocator<detail::FutureState<Value>>()))
+    {}
+
+    Promise(Promise&&) = default;
+    Promise& operator=(Promise&&) = default;
+
+    /* a promise dropped without a result fails its future */
+    ~Promise()
+    {
+        if (state && !state->ready.load(std::memory_order_relaxed)) {
+            set_exception(std::make_exception_ptr(
+                std::runtime_error("promise dropped without a result")));
+        }
+    }
+
+    Future<T> get_future() { return Future<T>(state); }
+
+    template <typename... Args> void set_value(Args&&... args)
+    {
+        if constexpr (std::is_void_v<T>) {
+            state->value.emplace();
+        } else {
+            state->value.emplace(std::forward<Args>(args)...);
+        }
+        state->set_ready();
+    }
+
+    void set_exception(std::exception_ptr eptr)
+    {
+        state->eptr = eptr;
+        state->set_ready();
+    }
+
+private:
+    using Value = typename Future<T>::Value;
+
+    std::shared_ptr<detail::FutureState<Value>> state;
+};
+
+} // namespace coco
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef _COCO_SPINLOCK_H_
 #define _COCO_SPINLOCK_H_
 
+#include "coco/preempt.h"
+
 #include <atomic>
 
 namespace coco {
@@ -9,15 +11,30 @@ class SpinLock {
 public:
     SpinLock() : flag(ATOMIC_FLAG_INIT) {}
 
+    /* preemption goes off before the lock is taken so that a task is never
+     * preempted while holding it */
     void lock()
     {
+        preempt_disable();
         while (flag.test_and_set(std::memory_order_acquire))
             ;
     }
 
-    bool try_lock() { return !flag.test_and_set(std::memory_order_release); }
+    bool try_lock()
+    {
+        preempt_disable();
+        if (flag.test_and_set(std::memory_order_acquire)) {
+            preempt_enable();
+            return false;
+        }
+        return true;
+    }
 
-    void unlock() { flag.clear(std::memory_order_release); }
+    void unlock()
+    {
+        flag.clear(std::memory_order_release);
+        preempt_enable();
+    }
 
 private:
     std::atomic_flag flag;
@@ -2,7 +2,15 @@
 #define _COCO_SYSCALLS_H_
 
 #include <cstddef>
+#include <netdb.h>
 #include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 extern "C"
@@ -13,14 +21,122 @@ extern "C"
     typedef int (*pipe_t)(int pipefd[2]);
     extern pipe_t pipe_f;
 
+    typedef int (*socket_t)(int domain, int type, int protocol);
+    extern socket_t socket_f;
+
+    typedef int (*socketpair_t)(int domain, int type, int protocol, int sv[2]);
+    extern socketpair_t socketpair_f;
+
+    typedef int (*accept4_t)(int fd, struct sockaddr* addr, socklen_t* addrlen,
+                             int flags);
+    extern accept4_t accept4_f;
+
+    typedef int (*connect_t)(int fd, const struct sockaddr* addr,
+                             socklen_t addrlen);
+    extern connect_t connect_f;
+
+    typedef int (*close_t)(int fd);
+    extern close_t close_f;
+
     typedef ssize_t (*read_t)(int fd, void* buf, size_t size);
     extern read_t read_f;
 
     typedef ssize_t (*write_t)(int fd, const void* buf, size_t size);
     extern write_t write_f;
 
+    typedef ssize_t (*readv_t)(int fd, const struct iovec* iov, int iovcnt);
+    extern readv_t readv_f;
+
+    typedef ssize_t (*writev_t)(int fd, const struct iovec* iov, int iovcnt);
+    extern writev_t writev_f;
+
+    typedef ssize_t (*recv_t)(int fd, void* buf, size_t len, int flags);
+    extern recv_t recv_f;
+
+    typedef ssize_t (*recvfrom_t)(int fd, void* buf, size_t len, int flags,
+                                  struct sockaddr* src_addr,
+                                  socklen_t* addrlen);
+    extern recvfrom_t recvfrom_f;
+
+    typedef ssize_t (*recvmsg_t)(int fd, struct msghdr* msg, int flags);
+    extern recvmsg_t recvmsg_f;
+
+    typedef ssize_t (*send_t)(int fd, const void* buf, size_t len, int flags);
+    extern send_t send_f;
+
+    typedef ssize_t (*sendto_t)(int fd, const void* buf, size_t len, int flags,
+                                const struct sockaddr* dest_addr,
+                                socklen_t addrlen);
+    extern sendto_t sendto_f;
+
+    typedef ssize_t (*sendmsg_t)(int fd, const struct msghdr* msg, int flags);
+    extern sendmsg_t sendmsg_f;
+
+    typedef ssize_t (*sendfile_t)(int out_fd, int in_fd, off_t* offset,
+                                  size_t count);
+    extern sendfile_t sendfile_f;
+
+    typedef ssize_t (*splice_t)(int fd_in, loff_t* off_in, int fd_out,
+                                loff_t* off_out, size_t len,
+                                unsigned int flags);
+    extern splice_t splice_f;
+
+    typedef ssize_t (*tee_t)(int fd_in, int fd_out, size_t len,
+                             unsigned int flags);
+    extern tee_t tee_f;
+
+    typedef ssize_t (*copy_file_range_t)(int fd_in, loff_t* off_in, int fd_out,
+                                         loff_t* off_out, size_t len,
+                                         unsigned int flags);
+    extern copy_file_range_t copy_file_range_f;
+
+    typedef int (*fsync_t)(int fd);
+    extern fsync_t fsync_f;
+
+    typedef int (*fdatasync_t)(int fd);
+    extern fdatasync_t fdatasync_f;
+
+    typedef int (*stat_t)(const char* pathname, struct stat* statbuf);
+    extern stat_t stat_f;
+
+    typedef int (*lstat_t)(const char* pathname, struct stat* statbuf);
+    extern lstat_t lstat_f;
+
+    typedef int (*getaddrinfo_t)(const char* node, const char* service,
+                                 const struct addrinfo* hints,
+                                 struct addrinfo** res);
+    extern getaddrinfo_t getaddrinfo_f;
+
     typedef int (*poll_t)(struct pollfd* fds, nfds_t nfds, int timeout);
     extern poll_t poll_f;
+
+    typedef int (*ppoll_t)(struct pollfd* fds, nfds_t nfds,
+                           const struct timespec* tmo_p,
+                           const sigset_t* sigmask);
+    extern ppoll_t ppoll_f;
+
+    typedef int (*select_t)(int nfds, fd_set* readfds, fd_set* writefds,
+                            fd_set* exceptfds, struct timeval* timeout);
+    extern select_t select_f;
+
+    typedef int (*pselect_t)(int nfds, fd_set* readfds, fd_set* writefds,
+                             fd_set* exceptfds, const struct timespec* timeout,
+                             const sigset_t* sigmask);
+    extern pselect_t pselect_f;
+
+    typedef int (*epoll_wait_t)(int epfd, struct epoll_event* events,
+                                int maxevents, int timeout);
+    extern epoll_wait_t epoll_wait_f;
+
+    typedef int (*fcntl_t)(int fd, int cmd, ...);
+    extern fcntl_t fcntl_f;
 }
 
+namespace coco {
+
+/* resolve the real implementations of the hooked calls */
+void init_hook();
+
+} // namespace coco
+
 #endif
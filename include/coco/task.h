@@ -1,15 +1,27 @@
 #ifndef _COCO_TASK_H_
 #define _COCO_TASK_H_
 
+#include "coco/histogram.h"
+#include "coco/slab.h"
 #include "coco/stackframe.h"
+#include "coco/trace.h"
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <vector>
 
 namespace coco {
 
-class Task {
+/* frees heap and mapped task stacks alike */
+struct StackDeleter {
+    size_t mapped_size = 0;
+    void operator()(uint8_t* p) const;
+};
+
+/* allocated from the slabs of the spawning thread */
+class Task : public SlabObject {
     friend class ThreadContext;
 
 public:
@@ -19,25 +31,98 @@ public:
         TERMINATED,
     };
 
-    Task(std::function<void()>&& func, size_t stacksize);
+    /* tasks without a class are counted as unlabeled ones */
+    Task(std::function<void()>&& func, size_t stacksize,
+         TaskClass* task_class = nullptr);
+    virtual ~Task() {}
+
+    /* the scheduler holds one reference, join handles hold the others */
+    void get() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void put()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
 
     void set_state(State state) { this->state = state; }
 
+    uint64_t get_id() const { return id; }
+    TaskClass* get_class() const { return task_class; }
+
+    size_t get_stacksize() const { return stacksize; }
+    /* all of the stack unless it is growable */
+    size_t get_stack_committed() const
+    {
+        return stack_mapped ? stack_top - stack_low : stacksize;
+    }
+
     bool check_stack_overflow();
 
+    /* deepest the stack has been in bytes, guard area included, found by
+     * scanning for the first overwritten word of the paint. 0 for a stack
+     * that was not painted */
+    size_t get_stack_usage() const;
+
+    /* commit the pages of a growable stack down to addr, called from the
+     * SIGSEGV handler. false if addr is not in the uncommitted part */
+    bool grow_stack(uintptr_t addr);
+
+    /* return addresses of a suspended task, innermost first. follows the
+     * frame pointers saved in its stack so it must not be running */
+    void backtrace(std::vector<void*>& frames, size_t max_frames = 64) const;
+
 private:
     static const size_t STACK_GUARD_SIZE = 0x1000;
+    static const uint8_t STACK_PAINT = 0xcc;
+    static const size_t STACK_INITIAL_COMMIT = 16 * 1024;
+
+    uint64_t id;
+    std::atomic<int> refs;
     State state;
-    std::unique_ptr<uint8_t[]> stack;
+    /* set while the task runs and until its context is saved after switching
+     * away, it must not be resumed on another thread before that */
+    std::atomic<bool> on_cpu;
+    std::unique_ptr<uint8_t[], StackDeleter> stack;
     size_t stacksize;
-    StackFrame* regs;
+    bool stack_painted;
+    /* a growable stack is committed from stack_low up to stack_top */
+    bool stack_mapped;
+    uintptr_t stack_low;
+    uintptr_t stack_top;
+    reg_t sp; /* saved stack pointer, points to a StackFrame */
     std::function<void()> func;
     std::exception_ptr eptr;
 
+    TaskClass* task_class;
+    /* rdtsc() when the task became runnable, 0 once it runs */
+    uint64_t runnable_tsc;
+    /* rdtsc() when the task was switched to */
+    uint64_t slice_tsc;
+
+    /* why the task last went to sleep */
+    ParkReason park_reason;
+    uint64_t park_arg;
+
     void init_stack(size_t stacksize);
+    /* a terminated task kept alive by a join handle gives its stack back */
+    void free_stack() { stack.reset(); }
+    void init_growable_stack(size_t stacksize);
+    /* make the stack accessible from low up to stack_low */
+    bool commit_stack(uintptr_t low);
     static void run(Task* task);
 };
 
+struct TaskDeleter {
+    void operator()(Task* task) const { task->put(); }
+};
+
+using TaskPtr = std::unique_ptr<Task, TaskDeleter>;
+
+/* woken instead of a parked task by the waiters which have one, e.g. a
+ * stackless coroutine (coco/async.h) waiting without a stack to park */
+struct Waker {
+    void (*wake)(Waker* waker);
+};
+
 } // namespace coco
 
 #endif
@@ -3,12 +3,19 @@
 
 #include "coco/io_context.h"
 #include "coco/io_poller.h"
+#include "coco/stats.h"
 #include "coco/sync/spinlock.h"
 #include "coco/task.h"
+#include "coco/timer.h"
+#include "coco/trace.h"
 
 #include <condition_variable>
+#include <csignal>
 #include <cstddef>
+#include <deque>
 #include <memory>
+#include <pthread.h>
+#include <ostream>
 #include <queue>
 #include <vector>
 
@@ -18,13 +25,17 @@ class Scheduler;
 class Task;
 
 class ThreadContext {
+    friend class Task;
+
 public:
     using Id = size_t;
     static const Id NO_THREAD_ID = 0;
 
     ThreadContext(Scheduler* parent, Id id);
+    ~ThreadContext();
 
     Id get_tid() const { return tid; }
+    Scheduler* get_scheduler() const { return parent; }
     size_t run_queue_size() const { return run_queue.size(); }
 
     bool empty() const
@@ -44,24 +55,81 @@ public:
     static Task* get_current_task();
     static IOPoller* get_current_io_poller();
     bool is_waiting() const { return waiting; }
-    IOPoller* get_io_poller() { return &io_poller; }
+    IOPoller* get_io_poller() { return io_poller.get(); }
 
-    void queue_task(std::unique_ptr<Task> task);
-    void steal_tasks(size_t n, std::vector<std::unique_ptr<Task>>& tasks);
+    void queue_task(TaskPtr task);
+    void steal_tasks(size_t n, std::vector<TaskPtr>& tasks);
     void notify();
     void poll_io();
 
     void run();
     void stop();
+    /* undo stop() before the next run */
+    void restart();
 
     void gc();
+    /* drop every task of the thread along with the I/O they were waiting
+     * for and zero the counters. only while the thread does not run */
+    void drop_tasks();
 
     static void yield();
-    static void sleep();
-    static void set_sleep();
+    static void sleep(ParkReason reason = ParkReason::OTHER, uint64_t arg = 0);
+    /* arg is the fd or the futex address for tracing */
+    static void set_sleep(ParkReason reason = ParkReason::OTHER,
+                          uint64_t arg = 0);
 
     void wake_up(Task* task);
 
+    StatsCounters& get_counters() { return counters; }
+    /* counters plus the queue lengths at the time of the call */
+    WorkerStats get_stats();
+
+    /* list the tasks of this thread with the stacks of the suspended ones */
+    void dump_tasks(std::ostream& os);
+
+    /* rdtsc() when the running task was switched to, 0 when idle */
+    uint64_t get_slice_start() const
+    {
+        return slice_start.load(std::memory_order_relaxed);
+    }
+    uint64_t get_slice_task() const
+    {
+        return slice_task.load(std::memory_order_relaxed);
+    }
+
+    /* install the handler for signo which forces the running task of a
+     * thread to yield once it is back in code of the executable outside of
+     * the scheduler. false if the cpu can not save the extended state */
+    static bool enable_preemption(int signo);
+    /* ask the running task to yield, see enable_preemption() */
+    void request_preempt();
+    /* called by coco_async_preempt() on the preempted task's stack */
+    static void preempt();
+
+    void trace(TraceEvent type, Task* task, uint64_t arg = 0,
+               ParkReason reason = ParkReason::OTHER)
+    {
+        if (Tracer::is_enabled()) trace_event(type, task, arg, reason);
+    }
+
+    /* the task whose stack the thread runs on, for the growable stack fault
+     * handler. only the thread itself touches it */
+    Task* get_stack_task() const { return stack_task; }
+    void set_stack_task(Task* task) { stack_task = task; }
+
+    /* frames of the stackless coroutines made ready on the thread, resumed
+     * in order by a driver task, see coco/async.h */
+    struct AsyncQueue {
+        SpinLock lock;
+        std::deque<void*> ready;
+        bool draining = false;
+    };
+    AsyncQueue& get_async_queue() { return async_queue; }
+
+    /* timers are queued on the thread the task sleeps on */
+    void add_timer(Timer* timer) { timers.add(timer); }
+    bool remove_timer(Timer* timer) { return timers.remove(timer); }
+
 private:
     Scheduler* parent;
     Id tid;
@@ -71,22 +139,57 @@ private:
 
     Task idle_task;
 
-    std::unique_ptr<Task> current_task;
-    std::queue<std::unique_ptr<Task>> run_queue;
-    std::vector<std::unique_ptr<Task>> waiting_queue;
-    std::queue<std::unique_ptr<Task>> zombie_queue;
+    TaskPtr current_task;
+    Task* switch_prev;
+    std::deque<TaskPtr> run_queue;
+    std::vector<TaskPtr> waiting_queue;
+    std::queue<TaskPtr> zombie_queue;
     SpinLock run_queue_lock;
 
     std::mutex cv_mutex;
     std::condition_variable cv;
 
-    IOPoller io_poller;
+    std::unique_ptr<IOPoller> io_poller;
+    TimerQueue timers;
+    AsyncQueue async_queue;
+
+    StatsCounters counters;
+    /* which of the per worker latency histograms we record into, see
+     * TaskClass::acquire_worker_slot() */
+    int histogram_slot;
+    std::atomic<TraceBuffer*> trace_buf;
+
+    std::atomic<uint64_t> slice_start;
+    std::atomic<uint64_t> slice_task;
+
+    pthread_t native_thread;
+    std::atomic<bool> native_thread_valid;
+    std::atomic<bool> preempt_requested;
+    bool preempting; /* the current yield was forced */
+    static int preempt_signo;
+
+    /* for the growable stack fault handler */
+    static const size_t SIGNAL_STACK_SIZE = 64 * 1024;
+    std::unique_ptr<uint8_t[]> signal_stack;
+    Task* stack_task;
 
     void wait();
+    void run_timers();
 
     void yield_current();
-    void sleep_current(bool yield_now);
-    __attribute__((naked)) Task* switch_to(Task* prev, Task* next);
+    void sleep_current(bool yield_now, ParkReason reason, uint64_t arg);
+    void finish_switch();
+    void account_switch(Task* prev, Task* next);
+    void trace_event(TraceEvent type, Task* task, uint64_t arg,
+                     ParkReason reason);
+    static void handle_preempt_signal(int signo, siginfo_t* info, void* ctx);
+    Task* switch_to(Task* prev, Task* next)
+    {
+        Task* from = coco_switch_context(prev, &prev->sp, &next->sp);
+        /* back on prev's stack, possibly on another thread */
+        get_current_thread()->stack_task = prev;
+        return from;
+    }
 };
 
 } // namespace coco
@@ -0,0 +1,67 @@
+#ifndef _COCO_TIMER_H_
+#define _COCO_TIMER_H_
+
+#include "coco/sync/spinlock.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace coco {
+
+class Task;
+class ThreadContext;
+
+using Clock = std::chrono::steady_clock;
+
+/* wakes up a sleeping task at the deadline. timers live in the sleeper's
+ * stack frame and are queued on the thread the task sleeps on */
+struct Timer {
+    static const size_t NOT_QUEUED = (size_t)-1;
+
+    Clock::time_point deadline;
+    ThreadContext* thread;
+    Task* task;
+    size_t index; /* position in the heap */
+    bool fired;
+
+    Timer(Clock::time_point deadline, ThreadContext* thread, Task* task)
+        : deadline(deadline), thread(thread), task(task), index(NOT_QUEUED),
+          fired(false)
+    {}
+};
+
+/* min-heap of timers ordered by deadline */
+class TimerQueue {
+public:
+    TimerQueue() : size(0) {}
+
+    bool empty() const { return size.load(std::memory_order_relaxed) == 0; }
+
+    void add(Timer* timer);
+    /* returns false if the timer has already fired */
+    bool remove(Timer* timer);
+
+    Clock::time_point next_deadline();
+
+    /* wake up the tasks whose deadline has passed */
+    void run(Clock::time_point now);
+
+    /* forget every timer, their tasks are being dropped */
+    void clear();
+
+private:
+    SpinLock lock;
+    std::vector<Timer*> heap;
+    std::atomic<size_t> size;
+
+    void swap_entries(size_t i, size_t j);
+    void sift_up(size_t i);
+    void sift_down(size_t i);
+    void remove_at(size_t i);
+};
+
+} // namespace coco
+
+#endif
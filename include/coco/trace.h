@@ -0,0 +1,115 @@
+#ifndef _COCO_TRACE_H_
+#define _COCO_TRACE_H_
+
+#include "coco/preempt.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+namespace coco {
+
+enum class TraceEvent : uint8_t {
+    SPAWN,      /* arg: id of the spawning task, 0 if none */
+    SWITCH_IN,  /* arg: TaskClass of the task */
+    SWITCH_OUT, /* arg: unused */
+    PARK,       /* arg: fd, futex address or 0 depending on the reason */
+    WAKE,       /* arg: tid of the waker, 0 if it is not a worker */
+    STEAL,      /* arg: tid of the worker the task was taken from */
+    TERMINATE,  /* arg: unused */
+};
+
+/* why a task went to sleep */
+enum class ParkReason : uint8_t {
+    OTHER,
+    YIELD,
+    IO,
+    FUTEX,
+    BLOCKING,
+    PREEMPT,
+};
+
+const char* get_park_reason_name(ParkReason reason);
+
+/* ring of the most recent events of one worker. any thread may append to
+ * it, a slot is published by its sequence number so that readers can skip
+ * the slots being overwritten */
+class TraceBuffer {
+public:
+    struct Record {
+        uint64_t tsc;
+        uint64_t task;
+        uint64_t arg;
+        TraceEvent type;
+        ParkReason reason;
+    };
+
+    TraceBuffer(size_t tid, size_t size);
+
+    size_t get_tid() const { return tid; }
+
+    void append(TraceEvent type, uint64_t task, uint64_t arg,
+                ParkReason reason);
+    /* copy out the records which are intact, oldest first */
+    void read(std::vector<Record>& records) const;
+    void clear();
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq; /* 2 * (index + 1) once written */
+        std::atomic<uint64_t> tsc;
+        std::atomic<uint64_t> task;
+        std::atomic<uint64_t> arg;
+        std::atomic<uint32_t> info; /* type | reason << 8 */
+    };
+
+    size_t tid;
+    size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> head;
+};
+
+/* opt-in recording of the scheduling timeline. when tracing is off the
+ * hooks cost a relaxed load and a predicted branch */
+class Tracer {
+public:
+    static const size_t DEFAULT_EVENTS_PER_THREAD = 64 * 1024;
+
+    static Tracer& get_instance();
+
+    static bool is_enabled()
+    {
+        return __builtin_expect(enabled.load(std::memory_order_relaxed),
+                                false);
+    }
+
+    /* starting again drops the events recorded so far. the buffer size only
+     * applies to workers which have not been traced before */
+    void start(size_t events_per_thread = DEFAULT_EVENTS_PER_THREAD);
+    void stop();
+
+    /* buffers live as long as the process so that the trace can be written
+     * after the scheduler is done */
+    TraceBuffer* get_buffer(size_t tid);
+
+    /* Chrome Trace Event JSON, which Perfetto and chrome://tracing load */
+    void write_json(std::ostream& os);
+    bool write_json(const char* path);
+
+private:
+    static std::atomic<bool> enabled;
+
+    PreemptMutex mutex;
+    size_t events_per_thread;
+    std::map<size_t, std::unique_ptr<TraceBuffer>> buffers;
+
+    Tracer() : events_per_thread(DEFAULT_EVENTS_PER_THREAD) {}
+};
+
+} // namespace coco
+
+#endif
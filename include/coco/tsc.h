@@ -0,0 +1,23 @@
+#ifndef _COCO_TSC_H_
+#define _COCO_TSC_H_
+
+#include <cstdint>
+
+namespace coco {
+
+/* cheap timestamps for hot paths, converted to wall time only on export */
+inline uint64_t rdtsc()
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* calibrated against the steady clock over the time since startup, the
+ * longer the process runs the more precise it gets */
+double tsc_to_ns(uint64_t cycles);
+uint64_t ns_to_tsc(uint64_t ns);
+
+} // namespace coco
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef _COCO_URING_POLLER_H_
+#define _COCO_URING_POLLER_H_
+
+#include "coco/epoll_poller.h"
+#include "coco/sync/spinlock.h"
+
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace coco {
+
+/* io_uring backend. operations submitted by the tasks of a thread are
+ * batched into one io_uring_enter() when the thread polls for I/O, readiness
+ * waits still go through the shared epoll instance */
+class UringPoller : public EpollPoller {
+public:
+    ~UringPoller();
+
+    /* returns nullptr if the kernel does not support io_uring */
+    static std::unique_ptr<UringPoller> create(ThreadContext* parent);
+    static void release_fd(PollableFileDesc* pfd);
+
+    Backend get_backend() const override { return Backend::IO_URING; }
+
+    bool can_submit() const override { return true; }
+    bool submit(Task* task, IORequest* req) override;
+    void cancel(IORequest* req) override;
+    bool register_buffers(const struct iovec* iov, unsigned nr) override;
+    void poll() override;
+
+private:
+    static const unsigned QUEUE_DEPTH = 256;
+    static const unsigned MAX_FIXED_FILES = 4096;
+    static const size_t MAX_COMPLETIONS = 64;
+
+    int ring_fd;
+    int ring_id; /* slot in the ring registry, -1 if there is no file table */
+    SpinLock ring_lock;
+
+    void* ring_ptr;
+    size_t ring_size;
+
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    unsigned sq_pending;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    unsigned nr_fixed_files;
+    std::vector<struct iovec> buffers;
+
+    UringPoller(ThreadContext* parent);
+
+    bool setup();
+    unsigned sq_space() const;
+    void prep_request(struct io_uring_sqe* sqe, IORequest* req);
+    bool queue_request(IORequest* req);
+    void flush();
+    size_t reap(IORequest** completed, size_t max);
+
+    int get_fixed_file(PollableFileDesc* pfd);
+    void unregister_file(int fd);
+    int find_buffer(const void* addr, size_t len) const;
+};
+
+}; // namespace coco
+
+#endif
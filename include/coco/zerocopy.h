@@ -0,0 +1,19 @@
+#ifndef _COCO_ZEROCOPY_H_
+#define _COCO_ZEROCOPY_H_
+
+#include <cstddef>
+#include <sys/types.h>
+
+namespace coco {
+
+/* send with MSG_ZEROCOPY so that the kernel transmits straight from buf.
+ * the calling task is parked until the kernel has released buf, which may be
+ * reused once this returns. like send() it can send less than len. sockets
+ * which do not support zero-copy fall back to a plain send(). returns -1 with
+ * errno set if the release can not be waited for, e.g. because the fd was
+ * closed meanwhile, and the kernel may then still read from buf */
+ssize_t send_zerocopy(int fd, const void* buf, size_t len, int flags = 0);
+
+} // namespace coco
+
+#endif
@@ -0,0 +1,106 @@
+#include "coco/async.h"
+#include "coco/coop.h"
+#include "coco/epoch.h"
+#include "coco/io_context.h"
+#include "coco/syscalls.h"
+
+#include <cerrno>
+#include <mutex>
+
+namespace coco {
+
+namespace detail {
+
+/* coroutines resumed by a driver before other tasks get a turn */
+static const int DRIVER_BATCH = 64;
+static const size_t DRIVER_STACK_SIZE = 256 * 1024;
+
+/* runs until the thread has no ready coroutines left */
+static void drive(ThreadContext* thread)
+{
+    auto& queue = thread->get_async_queue();
+    int resumed = 0;
+
+    while (true) {
+        void* frame;
+        {
+            std::lock_guard<SpinLock> lock(queue.lock);
+            if (queue.ready.empty()) {
+                queue.draining = false;
+                return;
+            }
+
+            frame = queue.ready.front();
+            queue.ready.pop_front();
+        }
+
+        std::coroutine_handle<>::from_address(frame).resume();
+
+        if (++resumed % DRIVER_BATCH == 0) ThreadContext::yield();
+    }
+}
+
+void async_post(ThreadContext* thread, std::coroutine_handle<> handle)
+{
+    auto& queue = thread->get_async_queue();
+    bool start;
+    {
+        std::lock_guard<SpinLock> lock(queue.lock);
+        queue.ready.push_back(handle.address());
+        start = !queue.draining;
+        queue.draining = true;
+    }
+
+    if (start) {
+        static TaskClass* driver_class = TaskClass::get("coco::async");
+        thread->get_scheduler()->go([thread] { drive(thread); },
+                                    DRIVER_STACK_SIZE, driver_class);
+    }
+}
+
+} // namespace detail
+
+/* the async counterpart of do_rdwt() in syscalls.cpp */
+template <typename F, typename... Args>
+static async<ssize_t> async_rdwt(int fd, F fn, short event, Args... args)
+{
+    bool pollable, user_nonblock;
+    {
+        EpochGuard guard;
+        auto* pfd = IOContext::get_instance().get_pfd(fd);
+
+        pollable = pfd && pfd->is_pollable();
+        user_nonblock = pfd && pfd->is_user_nonblock();
+    }
+
+    while (true) {
+        /* yields the driver, the other coroutines of the thread included */
+        consume_budget();
+
+        ssize_t retval;
+        do {
+            retval = fn(fd, args...);
+        } while (retval == -1 && errno == EINTR);
+
+        /* fds which are not polled block the driver, like regular files */
+        if (retval != -1 || errno != EAGAIN || !pollable || user_nonblock) {
+            co_return retval;
+        }
+
+        co_await async_poll(fd, event);
+    }
+}
+
+async<ssize_t> async_read(int fd, void* buf, size_t count)
+{
+    if (!read_f) init_hook();
+    return async_rdwt(fd, read_f, POLLIN, buf, count);
+}
+
+async<ssize_t> async_write(int fd, const void* buf, size_t count)
+{
+    if (!write_f) init_hook();
+    return async_rdwt(fd, write_f, POLLOUT, buf, count);
+}
+
+} // namespace coco
@@ -0,0 +1,102 @@
+#include "coco/blocking.h"
+
+namespace coco {
+
+BlockingPool::BlockingPool(size_t max_threads)
+    : head(nullptr), tail(nullptr), max_threads(max_threads), idle_threads(0),
+      stopped(false)
+{}
+
+BlockingPool::~BlockingPool()
+{
+    {
+        std::lock_guard<PreemptMutex> lock(mutex);
+        stopped = true;
+    }
+
+    cv.notify_all();
+
+    for (auto&& t : threads) {
+        t.join();
+    }
+}
+
+BlockingPool& BlockingPool::get_instance()
+{
+    static BlockingPool pool(DEFAULT_MAX_THREADS);
+    return pool;
+}
+
+void BlockingPool::set_max_threads(size_t n)
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+    max_threads = n ? n : 1;
+}
+
+void BlockingPool::run(BlockingJob* job)
+{
+    /* go to sleep before the job is visible to the helpers so that the wake
+     * up can not get lost */
+    ThreadContext::set_sleep(ParkReason::BLOCKING);
+
+    job->thread = ThreadContext::get_current_thread();
+    job->task = ThreadContext::get_current_task();
+    job->next = nullptr;
+    submit(job);
+    ThreadContext::yield();
+}
+
+void BlockingPool::submit(BlockingJob* job)
+{
+    {
+        std::lock_guard<PreemptMutex> lock(mutex);
+
+        if (tail) {
+            tail->next = job;
+        } else {
+            head = job;
+        }
+        tail = job;
+
+        /* threads are started on demand up to the limit, after that jobs
+         * wait for a helper to become free */
+        if (!idle_threads && threads.size() < max_threads) {
+            threads.emplace_back(&BlockingPool::worker_thread_func, this);
+            return;
+        }
+    }
+
+    cv.notify_one();
+}
+
+void BlockingPool::worker_thread_func()
+{
+    std::unique_lock<PreemptMutex> lock(mutex);
+
+    while (true) {
+        while (!head && !stopped) {
+            idle_threads++;
+            cv.wait(lock);
+            idle_threads--;
+        }
+
+        if (!head) break;
+
+        auto* job = head;
+        head = job->next;
+        if (!head) tail = nullptr;
+
+        lock.unlock();
+
+        job->run();
+
+        /* the job lives on the task's stack and is gone once it is woken up */
+        auto* thread = job->thread;
+        auto* task = job->task;
+        thread->wake_up(task);
+
+        lock.lock();
+    }
+}
+
+} // namespace coco
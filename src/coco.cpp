@@ -2,13 +2,39 @@
 
 namespace coco {
 
+/* tasks spawn onto the scheduler they run on */
+static Scheduler& get_scheduler()
+{
+    auto* sched = Scheduler::get_current();
+    return sched ? *sched : Scheduler::get_instance();
+}
+
 void go(std::function<void()>&& fn, size_t stacksize)
 {
-    Scheduler::get_instance().go(std::move(fn), stacksize);
+    get_scheduler().go(std::move(fn), stacksize);
+}
+
+void go(const char* label, std::function<void()>&& fn, size_t stacksize)
+{
+    get_scheduler().go(std::move(fn), stacksize, label);
+}
+
+void go(TaskClass* task_class, std::function<void()>&& fn, size_t stacksize)
+{
+    get_scheduler().go(std::move(fn), stacksize, task_class);
+}
+
+void go(Scheduler& sched, std::function<void()>&& fn, size_t stacksize)
+{
+    sched.go(std::move(fn), stacksize);
 }
 
 void run() { Scheduler::get_instance().run(); }
 
+void shutdown() { Scheduler::get_instance().shutdown(); }
+
 void yield() { ThreadContext::yield(); }
 
+void dump_tasks(std::ostream& os) { get_scheduler().dump_tasks(os); }
+
 } // namespace coco
@@ -0,0 +1,159 @@
+#include "coco/stackframe.h"
+
+/* set up once preemption is enabled */
+unsigned long coco_xsave_size = 0;
+
+/* written out in full rather than as naked functions so that the switch and
+ * the task entry carry CFI, which lets perf, gdb and other unwinders walk
+ * through them and stop cleanly at the root of a task's stack */
+__asm__(".text\n"
+        ".globl coco_switch_context\n"
+        ".type coco_switch_context, @function\n"
+        ".p2align 4\n"
+        "coco_switch_context:\n"
+        "    .cfi_startproc\n"
+        "    push %rbx\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    .cfi_rel_offset %rbx, 0\n"
+        "    push %rbp\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    .cfi_rel_offset %rbp, 0\n"
+        "    push %r12\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    .cfi_rel_offset %r12, 0\n"
+        "    push %r13\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    .cfi_rel_offset %r13, 0\n"
+        "    push %r14\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    .cfi_rel_offset %r14, 0\n"
+        "    push %r15\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    .cfi_rel_offset %r15, 0\n"
+        "    push %rdi\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    mov %rdi, %rax\n"
+        /* the next stack has the same layout, the CFI above describes it
+         * just as well */
+        "    mov %rsp, (%rsi)\n"
+        "    mov (%rdx), %rsp\n"
+        "    pop %rdi\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %r15\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    .cfi_restore %r15\n"
+        "    pop %r14\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    .cfi_restore %r14\n"
+        "    pop %r13\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    .cfi_restore %r13\n"
+        "    pop %r12\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    .cfi_restore %r12\n"
+        "    pop %rbp\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    .cfi_restore %rbp\n"
+        "    pop %rbx\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    .cfi_restore %rbx\n"
+        "    ret\n"
+        "    .cfi_endproc\n"
+        ".size coco_switch_context, .-coco_switch_context\n"
+
+        ".globl coco_task_entry\n"
+        ".globl coco_task_entry_end\n"
+        ".type coco_task_entry, @function\n"
+        ".p2align 4\n"
+        "coco_task_entry:\n"
+        "    .cfi_startproc\n"
+        /* the outermost frame, there is no return address to unwind to */
+        "    .cfi_undefined %rip\n"
+        "    xor %ebp, %ebp\n"
+        "    call *%r12\n"
+        "    ud2\n"
+        "coco_task_entry_end:\n"
+        "    .cfi_endproc\n"
+        ".size coco_task_entry, .-coco_task_entry\n"
+
+        /* entered instead of the interrupted instruction with the return
+         * address at the top of the stack and the red zone of the
+         * interrupted code above it. everything the interrupted code may
+         * have live is saved, ret $128 then skips the red zone */
+        ".globl coco_async_preempt\n"
+        ".type coco_async_preempt, @function\n"
+        ".p2align 4\n"
+        "coco_async_preempt:\n"
+        "    .cfi_startproc\n"
+        "    .cfi_signal_frame\n"
+        "    .cfi_def_cfa_offset 136\n"
+        "    .cfi_offset %rip, -136\n"
+        "    pushfq\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %rax\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %rcx\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %rdx\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %rsi\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %rdi\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %r8\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %r9\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %r10\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %r11\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    push %rbp\n"
+        "    .cfi_adjust_cfa_offset 8\n"
+        "    .cfi_rel_offset %rbp, 0\n"
+        "    mov %rsp, %rbp\n"
+        "    .cfi_def_cfa_register %rbp\n"
+        /* the extended state goes below, 64-byte aligned with its header
+         * cleared as xrstor insists on */
+        "    sub coco_xsave_size(%rip), %rsp\n"
+        "    and $-64, %rsp\n"
+        "    cld\n"
+        "    lea 512(%rsp), %rdi\n"
+        "    xor %eax, %eax\n"
+        "    mov $8, %ecx\n"
+        "    rep stosq\n"
+        "    mov $-1, %eax\n"
+        "    mov $-1, %edx\n"
+        "    xsave64 (%rsp)\n"
+        "    call coco_preempt\n"
+        "    mov $-1, %eax\n"
+        "    mov $-1, %edx\n"
+        "    xrstor64 (%rsp)\n"
+        "    mov %rbp, %rsp\n"
+        "    .cfi_def_cfa_register %rsp\n"
+        "    pop %rbp\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    .cfi_restore %rbp\n"
+        "    pop %r11\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %r10\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %r9\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %r8\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %rdi\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %rsi\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %rdx\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %rcx\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    pop %rax\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    popfq\n"
+        "    .cfi_adjust_cfa_offset -8\n"
+        "    ret $128\n"
+        "    .cfi_endproc\n"
+        ".size coco_async_preempt, .-coco_async_preempt\n");
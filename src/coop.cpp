@@ -0,0 +1,41 @@
+#include "coco/coop.h"
+#include "coco/preempt.h"
+#include "coco/thread_context.h"
+
+#include <atomic>
+
+namespace coco {
+
+namespace detail {
+
+static const unsigned int DEFAULT_COOP_BUDGET = 128;
+static std::atomic<unsigned int> coop_budget{DEFAULT_COOP_BUDGET};
+
+void coop_yield()
+{
+    /* not with a scheduler lock held, try again on the next unit */
+    if (preempt_off) {
+        coop_left = 1;
+        return;
+    }
+
+    auto* thread = ThreadContext::get_current_thread();
+    if (!thread || !ThreadContext::get_current_task()) return;
+
+    thread->get_counters().local.coop_yields.add();
+    ThreadContext::yield();
+}
+
+} // namespace detail
+
+void set_coop_budget(unsigned int budget)
+{
+    detail::coop_budget.store(budget, std::memory_order_relaxed);
+}
+
+unsigned int get_coop_budget()
+{
+    return detail::coop_budget.load(std::memory_order_relaxed);
+}
+
+} // namespace coco
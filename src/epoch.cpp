@@ -0,0 +1,159 @@
+#include "coco/epoch.h"
+#include "coco/preempt.h"
+
+namespace coco {
+
+namespace detail {
+
+/* gives the record back when the thread exits */
+struct EpochRecordHolder {
+    void* record = nullptr;
+    void (*release)(void*) = nullptr;
+
+    ~EpochRecordHolder()
+    {
+        if (record) release(record);
+    }
+};
+
+static thread_local EpochRecordHolder __epoch_record;
+
+} // namespace detail
+
+Epoch::Epoch() : global_epoch(1), records(nullptr) {}
+
+Epoch& Epoch::get_instance()
+{
+    static Epoch epoch;
+    return epoch;
+}
+
+Epoch::ThreadRecord* Epoch::get_record()
+{
+    auto* record = (ThreadRecord*)detail::__epoch_record.record;
+    if (__builtin_expect(!record, false)) {
+        record = acquire_record();
+        detail::__epoch_record.record = record;
+        detail::__epoch_record.release = [](void* p) {
+            release_record((ThreadRecord*)p);
+        };
+    }
+
+    return record;
+}
+
+Epoch::ThreadRecord* Epoch::acquire_record()
+{
+    /* records are never freed, reuse one left by an exited thread first */
+    for (auto* p = records.load(std::memory_order_acquire); p; p = p->next) {
+        bool in_use = false;
+        if (p->in_use.compare_exchange_strong(in_use, true)) {
+            return p;
+        }
+    }
+
+    auto* record = new ThreadRecord;
+    record->epoch.store(0, std::memory_order_relaxed);
+    record->in_use.store(true, std::memory_order_relaxed);
+    record->nesting = 0;
+
+    auto* head = records.load(std::memory_order_relaxed);
+    do {
+        record->next = head;
+    } while (!records.compare_exchange_weak(head, record,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+
+    return record;
+}
+
+void Epoch::release_record(ThreadRecord* record)
+{
+    record->nesting = 0;
+    record->epoch.store(0, std::memory_order_release);
+    record->in_use.store(false, std::memory_order_release);
+}
+
+void Epoch::enter()
+{
+    /* the record belongs to the thread, the task must not move */
+    preempt_disable();
+
+    auto* record = get_record();
+
+    if (record->nesting++ == 0) {
+        record->epoch.store(global_epoch.load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+        /* the announcement must be visible before we read any shared
+         * pointer */
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+void Epoch::exit()
+{
+    auto* record = get_record();
+
+    if (--record->nesting == 0) {
+        record->epoch.store(0, std::memory_order_release);
+    }
+
+    preempt_enable();
+}
+
+void Epoch::retire(void* ptr, void (*deleter)(void*))
+{
+    bool should_reclaim;
+    {
+        std::lock_guard<PreemptMutex> lock(retire_mutex);
+        retired.push_back(
+            {ptr, deleter, global_epoch.load(std::memory_order_acquire)});
+        should_reclaim = retired.size() >= RECLAIM_THRESHOLD;
+    }
+
+    if (should_reclaim) reclaim();
+}
+
+bool Epoch::try_advance(uint64_t epoch)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    for (auto* p = records.load(std::memory_order_acquire); p; p = p->next) {
+        uint64_t local = p->epoch.load(std::memory_order_acquire);
+        if (local && local != epoch) {
+            return false;
+        }
+    }
+
+    return global_epoch.compare_exchange_strong(epoch, epoch + 1);
+}
+
+void Epoch::reclaim()
+{
+    std::vector<RetiredObject> reclaimable;
+    {
+        std::lock_guard<PreemptMutex> lock(retire_mutex);
+
+        uint64_t epoch = global_epoch.load(std::memory_order_acquire);
+        if (try_advance(epoch)) epoch++;
+
+        /* an object retired in epoch e may still be seen by readers in e,
+         * they are all gone once the global epoch reaches e + 2 */
+        auto it = retired.begin();
+        while (it != retired.end()) {
+            if (it->epoch + 2 <= epoch) {
+                reclaimable.push_back(*it);
+                *it = retired.back();
+                retired.pop_back();
+            } else {
+                it++;
+            }
+        }
+    }
+
+    for (auto&& obj : reclaimable) {
+        obj.deleter(obj.ptr);
+    }
+}
+
+} // namespace coco
@@ -0,0 +1,89 @@
+#include "coco/epoll_poller.h"
+#include "coco/epoch.h"
+#include "coco/syscalls.h"
+#include "coco/thread_context.h"
+
+#include <poll.h>
+#include <sys/epoll.h>
+
+namespace coco {
+
+#define MAX_EVENTS 1024
+
+static short get_poll_events(int epoll_events)
+{
+    short retval = 0;
+
+    if (epoll_events & EPOLLIN) {
+        retval |= POLLIN;
+    }
+    if (epoll_events & EPOLLPRI) {
+        retval |= POLLPRI;
+    }
+    if (epoll_events & EPOLLOUT) {
+        retval |= POLLOUT;
+    }
+    if (epoll_events & EPOLLRDHUP) {
+        /* reading from a half-closed connection does not block */
+        retval |= POLLIN | POLLRDHUP;
+    }
+    if (epoll_events & EPOLLHUP) {
+        retval |= POLLHUP;
+    }
+    if (epoll_events & EPOLLERR) {
+        retval |= POLLERR;
+    }
+
+    return retval;
+}
+
+EpollPoller::EpollPoller(ThreadContext* parent) : IOPoller(parent)
+{
+    init_hook();
+
+    io_ctx = &IOContext::get_instance();
+}
+
+bool EpollPoller::add(int fd, PollEntry* entry)
+{
+    EpochGuard guard;
+
+    auto* pfd = io_ctx->get_pfd(fd);
+    if (!pfd || !pfd->is_pollable()) {
+        return false;
+    }
+
+    /* the fd is already registered with epoll, only the waiter needs to be
+     * queued (or woken up right away if the readiness is cached). the entry
+     * keeps the pfd alive for as long as the task waits */
+    entry->thread = parent;
+    entry->pfd = PPFd(pfd);
+    pfd->add(entry);
+
+    return true;
+}
+
+void EpollPoller::poll() { wait_and_process(0); }
+
+void EpollPoller::wait_and_process(int timeout)
+{
+    struct epoll_event evts[MAX_EVENTS];
+    int n = epoll_wait_f(io_ctx->get_epfd(), evts, MAX_EVENTS, timeout);
+
+    auto& counters = parent->get_counters();
+    counters.shared.epoll_waits.add();
+    if (n <= 0) return;
+    counters.shared.io_events.add(n);
+
+    EpochGuard guard;
+
+    for (int i = 0; i < n; i++) {
+        struct epoll_event* evt = &evts[i];
+        auto* pfd = io_ctx->get_pfd(evt->data.fd);
+        if (!pfd) continue;
+
+        pfd->notify(get_poll_events(evt->events));
+    }
+}
+
+} // namespace coco
@@ -0,0 +1,70 @@
+#include "coco/growable_stack.h"
+#include "coco/thread_context.h"
+
+#include <atomic>
+#include <csignal>
+#include <mutex>
+
+namespace coco {
+
+namespace detail {
+
+static std::atomic<bool> growable_stacks{false};
+static std::once_flag stack_fault_handler_once;
+static bool stack_fault_handler_installed = false;
+static struct sigaction prev_segv_action;
+
+} // namespace detail
+
+static void handle_stack_fault(int signo, siginfo_t* info, void* ctx)
+{
+    auto* thread = ThreadContext::get_current_thread();
+    Task* task = thread ? thread->get_stack_task() : nullptr;
+
+    if (task && task->grow_stack((uintptr_t)info->si_addr)) return;
+
+    /* not a stack growing down, hand the fault to whoever had it before */
+    auto& prev = detail::prev_segv_action;
+    if ((prev.sa_flags & SA_SIGINFO) && prev.sa_sigaction) {
+        prev.sa_sigaction(signo, info, ctx);
+    } else if (prev.sa_handler != SIG_DFL && prev.sa_handler != SIG_IGN) {
+        prev.sa_handler(signo);
+    } else {
+        /* the faulting instruction runs again and takes the default action */
+        signal(signo, SIG_DFL);
+    }
+}
+
+static void install_stack_fault_handler()
+{
+    struct sigaction sa = {};
+    sa.sa_sigaction = &handle_stack_fault;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+
+    detail::stack_fault_handler_installed =
+        !sigaction(SIGSEGV, &sa, &detail::prev_segv_action);
+}
+
+bool enable_growable_stacks()
+{
+    std::call_once(detail::stack_fault_handler_once,
+                   install_stack_fault_handler);
+    if (!detail::stack_fault_handler_installed) return false;
+
+    detail::growable_stacks.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void disable_growable_stacks()
+{
+    /* the handler stays, tasks spawned before may still grow */
+    detail::growable_stacks.store(false, std::memory_order_relaxed);
+}
+
+bool is_growable_stacks_enabled()
+{
+    return detail::growable_stacks.load(std::memory_order_relaxed);
+}
+
+} // namespace coco
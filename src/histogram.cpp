@@ -0,0 +1,235 @@
+#include "coco/histogram.h"
+#include "coco/perf_map.h"
+#include "coco/preempt.h"
+#include "coco/stack_profile.h"
+#include "coco/stackframe.h"
+#include "coco/tsc.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+
+namespace coco {
+
+namespace detail {
+
+static std::atomic<bool> latency_stats{false};
+
+static PreemptMutex task_classes_mutex;
+static std::map<std::string, std::unique_ptr<TaskClass>> task_classes;
+
+static PreemptMutex worker_slots_mutex;
+static bool worker_slots[TaskClass::MAX_WORKER_SLOTS];
+
+} // namespace detail
+
+uint64_t HistogramSnapshot::percentile(double p) const
+{
+    uint64_t rank = (uint64_t)(count * p / 100);
+    uint64_t seen = 0;
+
+    for (auto&& bucket : buckets) {
+        seen += bucket.count;
+        if (seen > rank) return std::min(bucket.upper, max);
+    }
+
+    return max;
+}
+
+uint64_t Histogram::get_lower_bound(int bucket)
+{
+    if (bucket < SUB_BUCKETS) return bucket;
+
+    int exp = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+    uint64_t sub = bucket % SUB_BUCKETS;
+
+    return (SUB_BUCKETS + sub) << (exp - SUB_BUCKET_BITS);
+}
+
+void Histogram::merge(const Histogram& other)
+{
+    for (int i = 0; i < NR_BUCKETS; i++) {
+        uint64_t count = other.buckets[i].load(std::memory_order_relaxed);
+        if (count) buckets[i].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    uint64_t other_max = other.max.load(std::memory_order_relaxed);
+    if (other_max > max.load(std::memory_order_relaxed)) {
+        max.store(other_max, std::memory_order_relaxed);
+    }
+}
+
+HistogramSnapshot Histogram::snapshot() const
+{
+    HistogramSnapshot snap;
+
+    for (int i = 0; i < NR_BUCKETS; i++) {
+        uint64_t count = buckets[i].load(std::memory_order_relaxed);
+        if (!count) continue;
+
+        uint64_t lower = tsc_to_ns(get_lower_bound(i));
+        uint64_t upper = i + 1 < NR_BUCKETS
+                             ? tsc_to_ns(get_lower_bound(i + 1))
+                             : UINT64_MAX;
+
+        snap.buckets.push_back({lower, upper, count});
+        snap.count += count;
+    }
+
+    snap.max = (uint64_t)tsc_to_ns(max.load(std::memory_order_relaxed));
+
+    return snap;
+}
+
+void enable_latency_stats()
+{
+    detail::latency_stats.store(true, std::memory_order_relaxed);
+}
+
+void disable_latency_stats()
+{
+    detail::latency_stats.store(false, std::memory_order_relaxed);
+}
+
+bool is_latency_stats_enabled()
+{
+    return detail::latency_stats.load(std::memory_order_relaxed);
+}
+
+int TaskClass::acquire_worker_slot()
+{
+    std::lock_guard<PreemptMutex> lock(detail::worker_slots_mutex);
+    for (int i = 0; i < MAX_WORKER_SLOTS; i++) {
+        if (!detail::worker_slots[i]) {
+            detail::worker_slots[i] = true;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void TaskClass::release_worker_slot(int slot)
+{
+    if (slot < 0) return;
+
+    /* the histograms stay with their classes, the next worker which gets
+     * the slot keeps adding to them */
+    std::lock_guard<PreemptMutex> lock(detail::worker_slots_mutex);
+    detail::worker_slots[slot] = false;
+}
+
+TaskClass::WorkerHistograms& TaskClass::create_histograms(int slot)
+{
+    /* only the slot holder gets here, so there is nobody to race with */
+    auto* p = new WorkerHistograms;
+    histograms[slot].store(p, std::memory_order_release);
+
+    return *p;
+}
+
+TaskClass* TaskClass::lookup(const std::string& label)
+{
+    std::lock_guard<PreemptMutex> lock(detail::task_classes_mutex);
+    auto& p = detail::task_classes[label];
+    if (!p) p.reset(new TaskClass(label));
+
+    return p.get();
+}
+
+TaskClass* TaskClass::get(const char* label)
+{
+    /* most tasks are unlabeled, keep the lock out of their spawn path */
+    static TaskClass* unlabeled = lookup(DEFAULT_LABEL);
+
+    return label ? lookup(label) : unlabeled;
+}
+
+void* TaskClass::get_entry()
+{
+    void* p = entry.load(std::memory_order_acquire);
+    if (p) return p;
+
+    if (!is_perf_map_enabled()) return (void*)&coco_task_entry;
+
+    p = create_labeled_entry(label);
+    if (!p) return (void*)&coco_task_entry;
+
+    /* racing creators leak a page, which is what it costs per label anyway */
+    void* expected = nullptr;
+    if (!entry.compare_exchange_strong(expected, p,
+                                       std::memory_order_acq_rel)) {
+        p = expected;
+    }
+
+    return p;
+}
+
+void TaskClass::record_stack_usage(size_t bytes)
+{
+    stack_total.fetch_add(bytes, std::memory_order_relaxed);
+    stack_samples.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t cur = stack_peak.load(std::memory_order_relaxed);
+    while (bytes > cur && !stack_peak.compare_exchange_weak(
+                              cur, bytes, std::memory_order_relaxed))
+        ;
+}
+
+size_t TaskClass::get_stack_size(size_t requested) const
+{
+    if (!is_stack_auto_sizing_enabled() ||
+        stack_samples.load(std::memory_order_relaxed) < STACK_MIN_SAMPLES) {
+        return requested;
+    }
+
+    /* the peak only grows, a class whose tasks go deeper than before gets
+     * bigger stacks from then on */
+    size_t size = MIN_STACK_SIZE;
+    size_t want = stack_peak.load(std::memory_order_relaxed) * STACK_HEADROOM;
+    while (size < want && size < requested) {
+        size <<= 1;
+    }
+
+    return std::min(size, requested);
+}
+
+std::vector<TaskClassStats> latency_stats()
+{
+    std::vector<TaskClassStats> stats;
+
+    std::lock_guard<PreemptMutex> lock(detail::task_classes_mutex);
+    for (auto&& p : detail::task_classes) {
+        auto* task_class = p.second.get();
+        TaskClassStats s;
+
+        /* large, keep it off the stack */
+        auto sum = std::make_unique<TaskClass::WorkerHistograms>();
+        for (auto&& h : task_class->histograms) {
+            auto* worker = h.load(std::memory_order_acquire);
+            if (!worker) continue;
+
+            sum->sched_delay.merge(worker->sched_delay);
+            sum->run_time.merge(worker->run_time);
+        }
+
+        s.label = p.first;
+        s.sched_delay = sum->sched_delay.snapshot();
+        s.run_time = sum->run_time.snapshot();
+
+        s.stack_samples =
+            task_class->stack_samples.load(std::memory_order_relaxed);
+        s.stack_peak = task_class->stack_peak.load(std::memory_order_relaxed);
+        if (s.stack_samples) {
+            s.stack_mean =
+                task_class->stack_total.load(std::memory_order_relaxed) /
+                s.stack_samples;
+        }
+
+        stats.push_back(std::move(s));
+    }
+
+    return stats;
+}
+
+} // namespace coco
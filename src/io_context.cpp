@@ -1,84 +1,204 @@
 #include "coco/io_context.h"
+#include "coco/epoch.h"
+#include "coco/io_poller.h"
+#include "coco/syscalls.h"
 #include "coco/thread_context.h"
 
+#include <fcntl.h>
 #include <poll.h>
+#include <sys/epoll.h>
 
 namespace coco {
 
-void PollableFileDesc::add(short& new_events, Task* task, short* revents,
-                           short& old_events)
+/* conditions that stay true once they happen and are reported to every
+ * waiter */
+static const short STICKY_EVENTS = POLLRDHUP | POLLERR | POLLHUP | POLLNVAL;
+static const short ERR_EVENTS = POLLERR | POLLHUP | POLLNVAL;
+
+static void wake_entry(PollEntry* entry)
+{
+    if (entry->waker) {
+        entry->waker->wake(entry->waker);
+    } else {
+        entry->thread->wake_up(entry->task);
+    }
+}
+
+bool PollableFileDesc::add(PollEntry* entry)
 {
-    std::lock_guard<std::mutex> lock(mutex);
+    std::lock_guard<PreemptMutex> lock(mutex);
+
+    short ready_events = ready & (entry->events | ERR_EVENTS);
+    if (ready_events) {
+        /* consume the cached edge instead of waiting for the next one */
+        ready &= ~(ready_events & ~STICKY_EVENTS);
+        entry->revents = ready_events;
+        wake_entry(entry);
 
-    auto entry = std::make_unique<PollEntry>(task, revents);
-    if ((new_events & (POLLIN | POLLOUT)) == (POLLIN | POLLOUT)) {
-        in_out_list.emplace_back(std::move(entry));
-    } else if (new_events & POLLIN) {
-        in_list.emplace_back(std::move(entry));
-    } else if (new_events & POLLOUT) {
-        out_list.emplace_back(std::move(entry));
+        return false;
+    }
+
+    EntryList* list;
+    if ((entry->events & (POLLIN | POLLPRI)) && (entry->events & POLLOUT)) {
+        list = &in_out_list;
+    } else if (entry->events & (POLLIN | POLLPRI)) {
+        list = &in_list;
+    } else if (entry->events & POLLOUT) {
+        list = &out_list;
     } else {
-        err_list.emplace_back(std::move(entry));
+        list = &err_list;
     }
 
-    old_events = events;
-    new_events = new_events & (POLLIN | POLLOUT);
-    if (!new_events) new_events = POLLERR;
+    entry->list = list;
+    entry->prev = nullptr;
+    entry->next = *list;
+    if (*list) (*list)->prev = entry;
+    *list = entry;
 
-    new_events = new_events | old_events;
-    events = new_events;
+    return true;
 }
 
-void PollableFileDesc::notify(ThreadContext* thread, short& events,
-                              short& old_events)
+void PollableFileDesc::remove(PollEntry* entry)
 {
-    std::lock_guard<std::mutex> lock(mutex);
+    std::lock_guard<PreemptMutex> lock(mutex);
 
-    short err_events = POLLERR | POLLHUP | POLLNVAL;
-    short pending_events = 0;
+    /* already taken off by a notification */
+    if (!entry->list) return;
 
-    short check_events = POLLIN | err_events;
-    if (events & check_events) {
-        wake_up_list(thread, &PollableFileDesc::in_list, check_events);
-    } else if (!in_list.empty()) {
-        pending_events |= POLLIN;
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        *entry->list = entry->next;
     }
+    if (entry->next) entry->next->prev = entry->prev;
 
-    check_events = POLLOUT | err_events;
-    if (events & check_events) {
-        wake_up_list(thread, &PollableFileDesc::out_list, check_events);
-    } else if (!out_list.empty()) {
-        pending_events |= POLLOUT;
+    entry->list = nullptr;
+    entry->prev = entry->next = nullptr;
+}
+
+void PollableFileDesc::notify(short events)
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+
+    ready |= events;
+
+    short consumed = 0;
+    consumed |= wake_up_list(&PollableFileDesc::in_list,
+                             POLLIN | POLLPRI | ERR_EVENTS);
+    consumed |= wake_up_list(&PollableFileDesc::out_list, POLLOUT | ERR_EVENTS);
+    consumed |= wake_up_list(&PollableFileDesc::in_out_list,
+                             POLLIN | POLLPRI | POLLOUT | ERR_EVENTS);
+    consumed |= wake_up_list(&PollableFileDesc::err_list, ERR_EVENTS);
+
+    /* readiness nobody was waiting for is kept for the next waiter */
+    ready &= ~(consumed & ~STICKY_EVENTS);
+}
+
+void PollableFileDesc::close()
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+
+    closed = true;
+    ready |= POLLNVAL;
+
+    wake_up_list(&PollableFileDesc::in_list, POLLNVAL);
+    wake_up_list(&PollableFileDesc::out_list, POLLNVAL);
+    wake_up_list(&PollableFileDesc::in_out_list, POLLNVAL);
+    wake_up_list(&PollableFileDesc::err_list, POLLNVAL);
+
+    /* operations in flight hold their own reference to the file and would
+     * never complete otherwise */
+    for (auto* req = requests; req; req = req->next) {
+        req->thread->get_io_poller()->cancel(req);
     }
+}
+
+void PollableFileDesc::clear_ready(short events)
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+    ready &= ~events;
+}
+
+bool PollableFileDesc::link_request(IORequest* req)
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
 
-    check_events = POLLIN | POLLOUT | err_events;
-    if (events & check_events) {
-        wake_up_list(thread, &PollableFileDesc::in_out_list, check_events);
-    } else if (!in_out_list.empty()) {
-        pending_events |= (POLLIN | POLLOUT);
+    if (closed) return false;
+
+    req->prev = nullptr;
+    req->next = requests;
+    if (requests) requests->prev = req;
+    requests = req;
+
+    return true;
+}
+
+void PollableFileDesc::unlink_request(IORequest* req)
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+
+    if (req->prev) {
+        req->prev->next = req->next;
+    } else {
+        requests = req->next;
     }
+    if (req->next) req->next->prev = req->prev;
+
+    req->prev = req->next = nullptr;
+}
 
-    check_events = err_events;
-    if (events & check_events) {
-        wake_up_list(thread, &PollableFileDesc::err_list, check_events);
-    } else if (!err_list.empty()) {
-        pending_events |= POLLERR;
+bool PollableFileDesc::is_closed()
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+    return closed;
+}
+
+ZeroCopyState* PollableFileDesc::get_zerocopy()
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+
+    if (!zerocopy) {
+        zerocopy = std::make_unique<ZeroCopyState>();
+    }
+
+    return zerocopy.get();
+}
+
+short PollableFileDesc::wake_up_list(EntryList PollableFileDesc::*list,
+                                     short check_events)
+{
+    auto* entry = this->*list;
+    if (!entry || !(ready & check_events)) {
+        return 0;
     }
 
-    old_events = events;
-    this->events = events = pending_events;
+    this->*list = nullptr;
+
+    while (entry) {
+        /* the entry is gone as soon as its task runs again */
+        auto* next = entry->next;
+
+        entry->revents = ready & (entry->events | ERR_EVENTS);
+        entry->list = nullptr;
+        entry->prev = entry->next = nullptr;
+        wake_entry(entry);
+
+        entry = next;
+    }
+
+    return ready & check_events;
 }
 
-void PollableFileDesc::wake_up_list(ThreadContext* thread,
-                                    EntryList PollableFileDesc::*list,
-                                    short revents)
+IOContext::IOContext()
 {
-    for (auto&& entry : this->*list) {
-        *entry->revents = revents;
-        thread->wake_up(entry->task);
+    for (auto&& chunk : fd_chunks) {
+        chunk.store(nullptr, std::memory_order_relaxed);
     }
 
-    (this->*list).clear();
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        throw std::runtime_error("failed to create epoll fd");
+    }
 }
 
 IOContext& IOContext::get_instance()
@@ -87,39 +207,99 @@ IOContext& IOContext::get_instance()
     return io_ctx;
 }
 
-void IOContext::create_pfd(int fd)
+void IOContext::create_pfd(int fd, bool replace)
 {
-    PPFd old_pfd;
-    {
-        std::unique_lock<std::shared_mutex> lock(pfd_mutex);
-        auto it = pfd_map.find(fd);
-        auto new_pfd = std::make_shared<PollableFileDesc>(fd);
+    int flags = fcntl_f(fd, F_GETFL);
+    if (flags == -1) return;
+
+    /* every fd is registered once for all events, edge-triggered, and stays
+     * registered until it is closed. readiness is tracked in the
+     * PollableFileDesc from then on */
+    struct epoll_event evt;
+    evt.data.fd = fd;
+    evt.events = EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+
+    int retval = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &evt);
+    if (retval == -1 && errno == EEXIST) {
+        retval = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &evt);
+    }
+
+    /* hooked fds are non-blocking under the hood so that read/write can be
+     * tried first and only park the task on EAGAIN. fds which epoll does
+     * not support (e.g. regular files) are left alone */
+    bool pollable = retval == 0;
+    bool user_nonblock = flags & O_NONBLOCK;
+    if (pollable && !user_nonblock &&
+        fcntl_f(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+        pollable = false;
+    }
+
+    auto* slot = get_slot(fd, true);
+    if (!slot) return;
+
+    auto* new_pfd = new PollableFileDesc(fd, pollable, user_nonblock);
 
-        if (it == pfd_map.end()) {
-            pfd_map.emplace(fd, std::move(new_pfd));
-            return;
+    if (!replace) {
+        PollableFileDesc* expected = nullptr;
+        if (!slot->compare_exchange_strong(expected, new_pfd,
+                                           std::memory_order_acq_rel)) {
+            /* someone else got there first, the epoll registration above
+             * was identical */
+            new_pfd->put();
         }
 
-        old_pfd = std::move(it->second);
-        it->second = std::move(new_pfd);
+        return;
     }
 
+    auto* old_pfd = slot->exchange(new_pfd, std::memory_order_acq_rel);
+
     if (old_pfd) {
-        close_pfd(old_pfd.get());
+        close_pfd(old_pfd);
+    }
+}
+
+void IOContext::remove_pfd(int fd)
+{
+    auto* slot = get_slot(fd, false);
+    if (!slot || !slot->load(std::memory_order_relaxed)) return;
+
+    auto* pfd = slot->exchange(nullptr, std::memory_order_acq_rel);
+    if (!pfd) return;
+
+    if (pfd->is_pollable()) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
     }
+
+    close_pfd(pfd);
 }
 
-PPFd IOContext::get_pfd(int fd)
+IOContext::FdChunk* IOContext::alloc_chunk(int index)
 {
-    std::shared_lock<std::shared_mutex> lock(pfd_mutex);
-    auto it = pfd_map.find(fd);
-    if (it == pfd_map.end()) {
-        return nullptr;
+    auto* chunk = new FdChunk;
+    for (auto&& slot : chunk->slots) {
+        slot.store(nullptr, std::memory_order_relaxed);
     }
 
-    return it->second;
+    FdChunk* expected = nullptr;
+    if (!fd_chunks[index].compare_exchange_strong(expected, chunk,
+                                                  std::memory_order_acq_rel)) {
+        /* someone else got there first */
+        delete chunk;
+        return expected;
+    }
+
+    return chunk;
 }
 
-void IOContext::close_pfd(PollableFileDesc* pfd) {}
+void IOContext::close_pfd(PollableFileDesc* pfd)
+{
+    IOPoller::release_fd(pfd);
+    pfd->close();
+
+    /* lock-free readers may still be looking at it */
+    Epoch::get_instance().retire(
+        pfd, [](void* p) { ((PollableFileDesc*)p)->put(); });
+}
 
 } // namespace coco
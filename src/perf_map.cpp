@@ -0,0 +1,79 @@
+#include "coco/perf_map.h"
+#include "coco/preempt.h"
+#include "coco/stackframe.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace coco {
+
+namespace detail {
+
+static std::atomic<bool> perf_map_enabled{false};
+static PreemptMutex perf_map_mutex;
+static FILE* perf_map_file = nullptr;
+
+} // namespace detail
+
+void enable_perf_map()
+{
+    std::lock_guard<PreemptMutex> lock(detail::perf_map_mutex);
+
+    if (!detail::perf_map_file) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+        detail::perf_map_file = fopen(path, "a");
+        if (!detail::perf_map_file) return;
+    }
+
+    detail::perf_map_enabled.store(true, std::memory_order_release);
+}
+
+void disable_perf_map()
+{
+    std::lock_guard<PreemptMutex> lock(detail::perf_map_mutex);
+
+    detail::perf_map_enabled.store(false, std::memory_order_release);
+    if (detail::perf_map_file) {
+        fclose(detail::perf_map_file);
+        detail::perf_map_file = nullptr;
+    }
+}
+
+bool is_perf_map_enabled()
+{
+    return detail::perf_map_enabled.load(std::memory_order_acquire);
+}
+
+void* create_labeled_entry(const std::string& label)
+{
+    size_t size = coco_task_entry_end - (const char*)&coco_task_entry;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+
+    /* the trampoline is position independent. a page of its own for each
+     * label keeps it from being written while another copy executes */
+    void* code = mmap(nullptr, page_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) return nullptr;
+
+    memcpy(code, (const void*)&coco_task_entry, size);
+    if (mprotect(code, page_size, PROT_READ | PROT_EXEC)) {
+        munmap(code, page_size);
+        return nullptr;
+    }
+
+    /* the map may have been closed since the caller checked */
+    std::lock_guard<PreemptMutex> lock(detail::perf_map_mutex);
+    if (detail::perf_map_file) {
+        fprintf(detail::perf_map_file, "%lx %zx coco_task[%s]\n",
+                (unsigned long)code, size, label.c_str());
+        fflush(detail::perf_map_file);
+    }
+
+    return code;
+}
+
+} // namespace coco
@@ -1,15 +1,31 @@
 #include "coco/scheduler.h"
+#include "coco/epoch.h"
+#include "coco/preempt.h"
+#include "coco/tsc.h"
 
+#include <algorithm>
 #include <chrono>
+#include <csignal>
+#include <iostream>
 #include <map>
+#include <pthread.h>
+#include <sched.h>
 
 namespace coco {
 
+std::atomic<bool> Scheduler::dump_requested{false};
+
 Scheduler::Scheduler(int nr_threads, uint64_t monitor_tick_us)
     : nr_threads(nr_threads), monitor_tick_us(monitor_tick_us), stopped(true),
-      eptr(nullptr)
+      eptr(nullptr), live_tasks(0), persistent(false), run_generation(0),
+      busy_workers(0), pool_shutdown(false), watchdog_slice_us(0),
+      watchdog_preempt(false), slice_handler(nullptr)
 {
-    threads.push_back(std::make_unique<ThreadContext>(this, 1));
+    /* the workers live as long as we do, so that other threads can queue
+     * tasks on them whether or not we are running */
+    for (int i = 0; i < std::max(nr_threads, 1); i++) {
+        threads.push_back(std::make_unique<ThreadContext>(this, i + 1));
+    }
 }
 
 Scheduler& Scheduler::get_instance()
@@ -18,44 +34,119 @@ Scheduler& Scheduler::get_instance()
     return sched;
 }
 
-void Scheduler::go(std::function<void()>&& fn, size_t stacksize)
+Scheduler* Scheduler::get_current()
+{
+    auto* thread = ThreadContext::get_current_thread();
+    return thread ? thread->get_scheduler() : nullptr;
+}
+
+void Scheduler::go(std::function<void()>&& fn, size_t stacksize,
+                   TaskClass* task_class)
+{
+    go(TaskPtr(new Task(std::move(fn), stacksize, task_class)));
+}
+
+void Scheduler::go(std::function<void()>&& fn, size_t stacksize,
+                   const char* label)
+{
+    go(std::move(fn), stacksize, TaskClass::get(label));
+}
+
+ThreadContext* Scheduler::get_spawn_thread()
+{
+    auto* thread = ThreadContext::get_current_thread();
+
+    /* tasks spawned from elsewhere start on our first worker */
+    if (!thread || thread->get_scheduler() != this) {
+        thread = threads.front().get();
+    }
+
+    return thread;
+}
+
+void Scheduler::go(TaskPtr new_task)
+{
+    auto* current = ThreadContext::get_current_thread();
+    bool remote = !current || current->get_scheduler() != this;
+
+    /* a task from outside lands either before or after shutdown() drops
+     * what is queued, never in between */
+    std::unique_lock<PreemptMutex> lock(remote_mutex, std::defer_lock);
+    if (remote) lock.lock();
+
+    auto* thread = get_spawn_thread();
+    auto* parent = ThreadContext::get_current_task();
+
+    thread->trace(TraceEvent::SPAWN, new_task.get(),
+                  parent ? parent->get_id() : 0);
+
+    task_started();
+
+    auto& counters = thread->get_counters();
+    counters.shared.spawns.add();
+    counters.shared.stack_allocated.add(new_task->get_stacksize());
+    counters.shared.stack_committed.add(new_task->get_stack_committed());
+
+    thread->queue_task(std::move(new_task));
+
+    /* nothing else wakes our workers for a task from outside, an idle one
+     * steals it if the first worker is busy */
+    if (remote) {
+        if (thread->is_waiting()) {
+            thread->notify();
+        } else {
+            notify_idle();
+        }
+    }
+}
+
+Scheduler::~Scheduler() { stop_workers(); }
+
+static void set_thread_affinity(pthread_t thread, const std::vector<int>& cpus,
+                                size_t index, bool all)
 {
-    auto thread = ThreadContext::get_current_thread();
-    auto new_task = std::make_unique<Task>(std::move(fn), stacksize);
+    cpu_set_t set;
+    CPU_ZERO(&set);
 
-    if (thread) {
-        thread->queue_task(std::move(new_task));
-        return;
+    if (all) {
+        for (int cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+    } else {
+        CPU_SET(cpus[index % cpus.size()], &set);
     }
 
-    threads.front()->queue_task(std::move(new_task));
+    pthread_setaffinity_np(thread, sizeof(set), &set);
 }
 
 void Scheduler::run()
 {
     auto* main_thread = threads.front().get();
-    std::vector<std::thread> native_threads;
+
+    /* nothing would ever return to stop us */
+    if (!get_live_tasks()) return;
 
     stopped = false;
     eptr = nullptr;
 
-    for (int i = 1; i < nr_threads; i++) {
-        ThreadContext::Id tid = threads.size() + 1;
-        threads.push_back(std::make_unique<ThreadContext>(this, tid));
-
-        auto* thread = threads.back().get();
-        native_threads.emplace_back([this, thread] {
-            try {
-                thread->run();
-            } catch (...) {
-                this->eptr = std::current_exception();
-                this->stop();
-            }
-        });
+    for (auto&& p : threads) {
+        p->restart();
     }
 
-    native_threads.emplace_back(
-        std::bind(&Scheduler::monitor_thread_func, this));
+    start_workers();
+
+    /* the caller gets its own mask back afterwards */
+    cpu_set_t saved;
+    bool pinned = !cpus.empty() && !pthread_getaffinity_np(
+                                       pthread_self(), sizeof(saved), &saved);
+    if (pinned) set_thread_affinity(pthread_self(), cpus, 0, false);
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        busy_workers = pool_threads.size();
+        run_generation++;
+    }
+    pool_cv.notify_all();
 
     try {
         main_thread->run();
@@ -64,45 +155,272 @@ void Scheduler::run()
         stop();
     }
 
-    for (auto&& t : native_threads) {
-        t.join();
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        pool_cv.wait(lock, [this] { return !busy_workers; });
     }
 
-    threads.clear();
-    threads.push_back(std::make_unique<ThreadContext>(this, 1));
+    if (pinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    }
+
+    /* tasks left behind by an exception are dropped. the ones queued from
+     * outside since the last one returned wait for the next run */
+    if (eptr) {
+        shutdown();
+    } else if (!persistent) {
+        stop_workers();
+        for (auto&& p : threads) {
+            p->gc();
+            p->get_counters().reset();
+        }
+    }
 
     if (eptr) {
         std::rethrow_exception(eptr);
     }
 }
 
+void Scheduler::shutdown()
+{
+    stop_workers();
+
+    std::lock_guard<PreemptMutex> lock(remote_mutex);
+    for (auto&& p : threads) {
+        p->drop_tasks();
+    }
+    live_tasks.store(0, std::memory_order_relaxed);
+}
+
+void Scheduler::stop_workers()
+{
+    if (pool_threads.empty()) return;
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pool_shutdown = true;
+    }
+    pool_cv.notify_all();
+
+    for (auto&& t : pool_threads) {
+        t.join();
+    }
+    pool_threads.clear();
+    pool_shutdown = false;
+}
+
+void Scheduler::start_workers()
+{
+    if (!pool_threads.empty()) return;
+
+    uint64_t generation = run_generation;
+    for (int i = 1; i < nr_threads; i++) {
+        auto* thread = threads[i].get();
+        pool_threads.emplace_back([this, thread, generation] {
+            pool_thread_func(generation, [this, thread] {
+                try {
+                    thread->run();
+                } catch (...) {
+                    this->eptr = std::current_exception();
+                    this->stop();
+                }
+            });
+        });
+    }
+
+    pool_threads.emplace_back([this, generation] {
+        pool_thread_func(generation, [this] { monitor_thread_func(); });
+    });
+
+    if (!cpus.empty()) {
+        for (size_t i = 0; i < pool_threads.size(); i++) {
+            bool monitor = i + 1 == pool_threads.size();
+            set_thread_affinity(pool_threads[i].native_handle(), cpus, i + 1,
+                                monitor);
+        }
+    }
+}
+
+void Scheduler::pool_thread_func(uint64_t generation,
+                                 const std::function<void()>& body)
+{
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            pool_cv.wait(lock, [this, generation] {
+                return pool_shutdown || run_generation != generation;
+            });
+            if (pool_shutdown) return;
+            generation = run_generation;
+        }
+
+        body();
+
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (!--busy_workers) pool_cv.notify_all();
+    }
+}
+
+/* may be called by a task, e.g. the last coroutine to return. the worker and
+ * monitor mutexes go with condition variables and are not PreemptMutexes */
 void Scheduler::stop()
 {
+    preempt_disable();
+
     for (auto&& p : threads) {
         p->stop();
         p->notify();
     }
 
-    stopped = true;
+    {
+        std::lock_guard<std::mutex> lock(monitor_mutex);
+        stopped = true;
+    }
+    monitor_cv.notify_all();
+
+    preempt_enable();
+}
+
+void Scheduler::task_exited()
+{
+    if (live_tasks.fetch_sub(1, std::memory_order_acq_rel) == 1) stop();
+}
+
+bool Scheduler::steal_work(ThreadContext* thief)
+{
+    if (stopped.load(std::memory_order_relaxed)) return false;
+
+    ThreadContext* victim = nullptr;
+    size_t load = 0;
+    for (auto&& p : threads) {
+        if (p.get() != thief && p->run_queue_size() > load) {
+            victim = p.get();
+            load = p->run_queue_size();
+        }
+    }
+    if (!victim) return false;
+
+    std::vector<TaskPtr> tasks;
+    victim->steal_tasks((load + 1) / 2, tasks);
+    if (tasks.empty()) return false;
+
+    thief->get_counters().shared.steals_in.add(tasks.size());
+    for (auto&& task : tasks) {
+        thief->trace(TraceEvent::STEAL, task.get(), victim->get_tid());
+        thief->queue_task(std::move(task));
+    }
+
+    return true;
+}
+
+void Scheduler::notify_idle()
+{
+    for (auto&& p : threads) {
+        if (p->is_waiting()) {
+            p->notify();
+            break;
+        }
+    }
+}
+
+SchedulerStats Scheduler::stats()
+{
+    SchedulerStats stats;
+
+    for (auto&& p : threads) {
+        stats.workers.push_back(p->get_stats());
+        stats.total += stats.workers.back();
+    }
+
+    stats.total.tid = stats.workers.size();
+    stats.live_tasks = get_live_tasks();
+
+    return stats;
+}
+
+bool Scheduler::set_watchdog(uint64_t slice_us, bool preempt, int signo)
+{
+    if (preempt && !ThreadContext::enable_preemption(signo)) return false;
+
+    watchdog_preempt.store(preempt, std::memory_order_relaxed);
+    watchdog_slice_us.store(slice_us, std::memory_order_relaxed);
+
+    return true;
+}
+
+void Scheduler::check_slices()
+{
+    uint64_t slice_us = watchdog_slice_us.load(std::memory_order_relaxed);
+    if (!slice_us) return;
+
+    bool preempt = watchdog_preempt.load(std::memory_order_relaxed);
+    auto* handler = slice_handler.load(std::memory_order_relaxed);
+    uint64_t limit = ns_to_tsc(slice_us * 1000);
+    uint64_t now = rdtsc();
+
+    for (auto&& p : threads) {
+        uint64_t start = p->get_slice_start();
+        if (!start || now < start || now - start < limit) continue;
+
+        /* report each slice once, the preemption is retried every tick until
+         * the task is at a safe point */
+        if (p->get_counters().flag_slice(start) && handler) {
+            handler(p->get_slice_task(), p->get_tid(),
+                    (uint64_t)tsc_to_ns(now - start));
+        }
+
+        if (preempt) p->request_preempt();
+    }
+}
+
+void Scheduler::dump_tasks(std::ostream& os)
+{
+    for (auto&& p : threads) {
+        p->dump_tasks(os);
+    }
+    os.flush();
+}
+
+void Scheduler::enable_dump_signal(int signo)
+{
+    struct sigaction sa = {};
+    sa.sa_handler = &Scheduler::handle_dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(signo, &sa, nullptr);
+}
+
+void Scheduler::handle_dump_signal(int)
+{
+    /* nothing in the dump is async-signal-safe, leave it to the monitor */
+    dump_requested.store(true, std::memory_order_relaxed);
 }
 
 void Scheduler::monitor_thread_func()
 {
-    while (!stopped) {
-        std::this_thread::sleep_for(std::chrono::microseconds(monitor_tick_us));
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(monitor_mutex);
+            monitor_cv.wait_for(lock,
+                                std::chrono::microseconds(monitor_tick_us),
+                                [this] { return stopped.load(); });
+            if (stopped) break;
+        }
+
+        if (dump_requested.exchange(false, std::memory_order_relaxed)) {
+            dump_tasks(std::cerr);
+        }
+
+        check_slices();
 
         std::multimap<size_t, ThreadContext*> load_map;
         size_t total_load = 0;
-        size_t empty_count = 0;
         for (auto&& p : threads) {
             total_load += p->run_queue_size();
             load_map.emplace(p->run_queue_size(), p.get());
 
             if (p->is_waiting()) {
-                if (p->empty()) {
-                    empty_count++;
-                    continue;
-                }
+                if (p->empty()) continue;
 
                 if (!p->run_queue_size()) {
                     p->poll_io();
@@ -117,11 +435,9 @@ void Scheduler::monitor_thread_func()
 
         size_t avg_load = total_load / threads.size();
 
-        if (empty_count == threads.size()) {
-            /* no more task to be done */
-            stop();
-            break;
-        }
+        /* free closed fds that no longer have readers even if nothing else
+         * gets retired for a while */
+        Epoch::get_instance().reclaim();
 
         /* steal tasks from threads with heavier load */
         if (!load_map.begin()->first) {
@@ -132,7 +448,7 @@ void Scheduler::monitor_thread_func()
             auto it = load_map.rbegin();
             while (it != load_map.rend() && it->first > avg_load) {
                 size_t n = it->first - avg_load;
-                std::vector<std::unique_ptr<Task>> tasks;
+                std::vector<TaskPtr> tasks;
                 it->second->steal_tasks(n, tasks);
 
                 size_t avg_tasks =
@@ -147,7 +463,10 @@ void Scheduler::monitor_thread_func()
                     if (np > avg_tasks) np = avg_tasks;
                     if (!np) break;
 
+                    p->second->get_counters().shared.steals_in.add(np);
                     while (np--) {
+                        p->second->trace(TraceEvent::STEAL, tp->get(),
+                                         it->second->get_tid());
                         p->second->queue_task(std::move(*tp++));
                     }
                 }
@@ -0,0 +1,272 @@
+#include "coco/slab.h"
+#include "coco/preempt.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+namespace coco {
+
+namespace detail {
+
+static const size_t SLAB_SIZE = 64 * 1024;
+
+/* 16 to 128 bytes in steps of 16, then four classes per power of two */
+static const int NR_SIZE_CLASSES = 24;
+
+static int get_size_class(size_t size)
+{
+    if (size <= 128) return size ? (size + 15) / 16 - 1 : 0;
+
+    int exp = 63 - __builtin_clzll(size - 1);
+    return 8 + (exp - 7) * 4 + (int)((size - 1) >> (exp - 2)) - 4;
+}
+
+static size_t get_class_size(int size_class)
+{
+    if (size_class < 8) return (size_class + 1) * 16;
+
+    int exp = 7 + (size_class - 8) / 4;
+    size_t sub = (size_class - 8) % 4 + 4;
+    return (sub + 1) << (exp - 2);
+}
+
+struct FreeObject {
+    FreeObject* next;
+};
+
+class SlabCache;
+
+/* header at the start of every slab, the objects follow it */
+struct Slab {
+    std::atomic<SlabCache*> owner; /* nullptr once abandoned */
+    int size_class;
+    size_t nr_objects;
+
+    /* only touched by the owner */
+    FreeObject* free_list;
+    size_t used;
+
+    /* pushed by other threads, taken as a whole by the owner */
+    alignas(64) std::atomic<FreeObject*> remote_free;
+
+    /* move the objects freed by other threads over to the free list */
+    void collect()
+    {
+        auto* obj = remote_free.exchange(nullptr, std::memory_order_acquire);
+        while (obj) {
+            auto* next = obj->next;
+            obj->next = free_list;
+            free_list = obj;
+            used--;
+            obj = next;
+        }
+    }
+
+    void push_remote(FreeObject* obj)
+    {
+        auto* head = remote_free.load(std::memory_order_relaxed);
+        do {
+            obj->next = head;
+        } while (!remote_free.compare_exchange_weak(
+            head, obj, std::memory_order_release, std::memory_order_relaxed));
+    }
+};
+
+static const size_t SLAB_HEADER_SIZE = (sizeof(Slab) + 63) & ~(size_t)63;
+
+static Slab* get_slab(void* p)
+{
+    return (Slab*)((uintptr_t)p & ~(SLAB_SIZE - 1));
+}
+
+/* slabs with live objects left behind by threads which exited, adopted by
+ * the next thread which needs a slab of the class */
+static std::mutex abandoned_mutex;
+static std::vector<Slab*> abandoned[NR_SIZE_CLASSES];
+
+class SlabCache {
+public:
+    ~SlabCache()
+    {
+        for (int i = 0; i < NR_SIZE_CLASSES; i++) {
+            for (auto* slab : slabs[i]) {
+                slab->collect();
+                if (!slab->used) {
+                    free(slab);
+                    continue;
+                }
+
+                std::lock_guard<std::mutex> lock(abandoned_mutex);
+                slab->owner.store(nullptr, std::memory_order_relaxed);
+                abandoned[i].push_back(slab);
+            }
+        }
+    }
+
+    void* alloc(int size_class)
+    {
+        Slab* slab = current[size_class];
+        if (!slab || !slab->free_list) {
+            slab = refill(size_class);
+            if (!slab) return nullptr;
+        }
+
+        auto* obj = slab->free_list;
+        slab->free_list = obj->next;
+        slab->used++;
+
+        return obj;
+    }
+
+    void free_local(Slab* slab, void* p)
+    {
+        auto* obj = (FreeObject*)p;
+        obj->next = slab->free_list;
+        slab->free_list = obj;
+        slab->used--;
+    }
+
+private:
+    Slab* current[NR_SIZE_CLASSES] = {};
+    std::vector<Slab*> slabs[NR_SIZE_CLASSES];
+
+    Slab* refill(int size_class)
+    {
+        /* objects other threads gave back come first */
+        for (auto* slab : slabs[size_class]) {
+            slab->collect();
+            if (slab->free_list) return current[size_class] = slab;
+        }
+
+        Slab* slab = adopt(size_class);
+        if (!slab) slab = create(size_class);
+        if (!slab) return nullptr;
+
+        slabs[size_class].push_back(slab);
+        return current[size_class] = slab;
+    }
+
+    Slab* adopt(int size_class)
+    {
+        std::lock_guard<std::mutex> lock(abandoned_mutex);
+
+        auto& list = abandoned[size_class];
+        if (list.empty()) return nullptr;
+
+        Slab* slab = list.back();
+        list.pop_back();
+        slab->owner.store(this, std::memory_order_relaxed);
+        slab->collect();
+
+        return slab;
+    }
+
+    Slab* create(int size_class)
+    {
+        void* p = aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+        if (!p) return nullptr;
+
+        auto* slab = new (p) Slab;
+        size_t size = get_class_size(size_class);
+
+        slab->owner.store(this, std::memory_order_relaxed);
+        slab->size_class = size_class;
+        slab->nr_objects = (SLAB_SIZE - SLAB_HEADER_SIZE) / size;
+        slab->free_list = nullptr;
+        slab->used = 0;
+        slab->remote_free.store(nullptr, std::memory_order_relaxed);
+
+        /* lowest address first */
+        auto* base = (uint8_t*)p + SLAB_HEADER_SIZE;
+        for (size_t i = slab->nr_objects; i-- > 0;) {
+            auto* obj = (FreeObject*)(base + i * size);
+            obj->next = slab->free_list;
+            slab->free_list = obj;
+        }
+
+        return slab;
+    }
+};
+
+/* a thread's cache goes away with the thread. anything it allocates while
+ * its thread_locals are being destroyed comes from a shared cache */
+static thread_local SlabCache* local_cache = nullptr;
+static thread_local bool local_cache_gone = false;
+
+struct SlabCacheHolder {
+    SlabCache* cache = nullptr;
+
+    ~SlabCacheHolder()
+    {
+        delete cache;
+        local_cache = nullptr;
+        local_cache_gone = true;
+    }
+};
+
+static thread_local SlabCacheHolder local_cache_holder;
+
+static std::mutex shared_cache_mutex;
+static SlabCache shared_cache;
+
+static SlabCache* get_local_cache()
+{
+    if (!local_cache && !local_cache_gone) {
+        /* the first touch of the holder registers it for destruction at
+         * thread exit */
+        local_cache = new SlabCache;
+        local_cache_holder.cache = local_cache;
+    }
+
+    return local_cache;
+}
+
+} // namespace detail
+
+void* slab_alloc(size_t size)
+{
+    if (size > SLAB_MAX_SIZE) return ::operator new(size);
+
+    int size_class = detail::get_size_class(size);
+    void* p;
+
+    /* a task preempted in here could be resumed by another worker and
+     * touch this thread's cache along with it */
+    preempt_disable();
+    if (auto* cache = detail::get_local_cache()) {
+        p = cache->alloc(size_class);
+    } else {
+        std::lock_guard<std::mutex> lock(detail::shared_cache_mutex);
+        p = detail::shared_cache.alloc(size_class);
+    }
+    preempt_enable();
+
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void slab_free(void* p, size_t size)
+{
+    if (!p) return;
+
+    if (size > SLAB_MAX_SIZE) {
+        ::operator delete(p);
+        return;
+    }
+
+    auto* slab = detail::get_slab(p);
+
+    preempt_disable();
+    auto* cache = detail::local_cache;
+    if (cache && slab->owner.load(std::memory_order_relaxed) == cache) {
+        cache->free_local(slab, p);
+    } else {
+        slab->push_remote((detail::FreeObject*)p);
+    }
+    preempt_enable();
+}
+
+} // namespace coco
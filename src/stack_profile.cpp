@@ -0,0 +1,36 @@
+#include "coco/stack_profile.h"
+
+#include <atomic>
+
+namespace coco {
+
+namespace detail {
+
+static std::atomic<bool> stack_painting{false};
+static std::atomic<bool> stack_auto_sizing{false};
+
+} // namespace detail
+
+void enable_stack_profiling(bool auto_size)
+{
+    detail::stack_auto_sizing.store(auto_size, std::memory_order_relaxed);
+    detail::stack_painting.store(true, std::memory_order_relaxed);
+}
+
+void disable_stack_profiling()
+{
+    detail::stack_painting.store(false, std::memory_order_relaxed);
+    detail::stack_auto_sizing.store(false, std::memory_order_relaxed);
+}
+
+bool is_stack_painting_enabled()
+{
+    return detail::stack_painting.load(std::memory_order_relaxed);
+}
+
+bool is_stack_auto_sizing_enabled()
+{
+    return detail::stack_auto_sizing.load(std::memory_order_relaxed);
+}
+
+} // namespace coco
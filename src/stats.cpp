@@ -0,0 +1,76 @@
+#include "coco/stats.h"
+
+namespace coco {
+
+WorkerStats& WorkerStats::operator+=(const WorkerStats& other)
+{
+    context_switches += other.context_switches;
+    spawns += other.spawns;
+    local_wakes += other.local_wakes;
+    remote_wakes += other.remote_wakes;
+    steals_in += other.steals_in;
+    steals_out += other.steals_out;
+    parks += other.parks;
+    idle_ns += other.idle_ns;
+    epoll_waits += other.epoll_waits;
+    io_events += other.io_events;
+    long_slices += other.long_slices;
+    preemptions += other.preemptions;
+    coop_yields += other.coop_yields;
+    runnable_tasks += other.runnable_tasks;
+    sleeping_tasks += other.sleeping_tasks;
+    zombie_tasks += other.zombie_tasks;
+    stack_reserved += other.stack_reserved;
+    stack_committed += other.stack_committed;
+
+    return *this;
+}
+
+void StatsCounters::reset()
+{
+    local.context_switches.reset();
+    local.local_wakes.reset();
+    local.parks.reset();
+    local.idle_ns.reset();
+    local.preemptions.reset();
+    local.coop_yields.reset();
+
+    shared.spawns.reset();
+    shared.remote_wakes.reset();
+    shared.steals_in.reset();
+    shared.steals_out.reset();
+    shared.epoll_waits.reset();
+    shared.io_events.reset();
+    shared.long_slices.reset();
+    shared.stack_allocated.reset();
+    shared.stack_freed.reset();
+    shared.stack_committed.reset();
+    shared.stack_released.reset();
+
+    flagged_slice = 0;
+}
+
+void StatsCounters::fill(WorkerStats& stats) const
+{
+    stats.context_switches = local.context_switches.get();
+    stats.local_wakes = local.local_wakes.get();
+    stats.parks = local.parks.get();
+    stats.idle_ns = local.idle_ns.get();
+    stats.preemptions = local.preemptions.get();
+    stats.coop_yields = local.coop_yields.get();
+
+    stats.spawns = shared.spawns.get();
+    stats.remote_wakes = shared.remote_wakes.get();
+    stats.steals_in = shared.steals_in.get();
+    stats.steals_out = shared.steals_out.get();
+    stats.epoll_waits = shared.epoll_waits.get();
+    stats.io_events = shared.io_events.get();
+    stats.long_slices = shared.long_slices.get();
+
+    stats.stack_reserved =
+        (int64_t)(shared.stack_allocated.get() - shared.stack_freed.get());
+    stats.stack_committed = (int64_t)(shared.stack_committed.get() -
+                                      shared.stack_released.get());
+}
+
+} // namespace coco
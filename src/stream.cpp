@@ -0,0 +1,266 @@
+#include "coco/stream.h"
+
+#include <cerrno>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <vector>
+
+namespace coco {
+
+static size_t round_up_pow2(size_t n)
+{
+    size_t size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+Stream::Stream(int fd, size_t read_buffer_size, size_t write_buffer_size)
+    : fd(fd), rcap(round_up_pow2(read_buffer_size ? read_buffer_size : 1)),
+      rhead(0), rtail(0), wcap(write_buffer_size ? write_buffer_size : 1),
+      wstart(0), wend(0)
+{
+    rbuf = std::make_unique<char[]>(rcap);
+    wbuf = std::make_unique<char[]>(wcap);
+}
+
+Stream::~Stream() { flush(); }
+
+ssize_t Stream::fill()
+{
+    /* whoever we are waiting for may be waiting for what we wrote */
+    if (pending() && flush() == -1) return -1;
+
+    size_t space = rcap - available();
+    size_t tail = rtail & (rcap - 1);
+
+    struct iovec iov[2];
+    int iovcnt = 1;
+    iov[0].iov_base = &rbuf[tail];
+    iov[0].iov_len = std::min(space, rcap - tail);
+    if (iov[0].iov_len < space) {
+        iov[1].iov_base = &rbuf[0];
+        iov[1].iov_len = space - iov[0].iov_len;
+        iovcnt = 2;
+    }
+
+    ssize_t n = ::readv(fd, iov, iovcnt);
+    if (n > 0) rtail += n;
+
+    return n;
+}
+
+void Stream::copy_out(void* buf, size_t len, bool consume)
+{
+    size_t head = rhead & (rcap - 1);
+    size_t first = std::min(len, rcap - head);
+
+    memcpy(buf, &rbuf[head], first);
+    memcpy((char*)buf + first, &rbuf[0], len - first);
+
+    if (consume) rhead += len;
+}
+
+ssize_t Stream::read(void* buf, size_t len)
+{
+    if (!len) return 0;
+
+    if (!available()) {
+        /* large reads skip the buffer */
+        if (len >= rcap) {
+            if (pending() && flush() == -1) return -1;
+            return ::read(fd, buf, len);
+        }
+
+        ssize_t n = fill();
+        if (n <= 0) return n;
+    }
+
+    size_t n = std::min(len, available());
+    copy_out(buf, n, true);
+
+    return n;
+}
+
+ssize_t Stream::read_exact(void* buf, size_t len)
+{
+    size_t total = 0;
+
+    while (total < len) {
+        size_t n = std::min(len - total, available());
+        copy_out((char*)buf + total, n, true);
+        total += n;
+
+        if (total == len) break;
+
+        ssize_t retval;
+        if (len - total >= rcap) {
+            if (pending() && flush() == -1) return -1;
+            retval = ::read(fd, (char*)buf + total, len - total);
+            if (retval > 0) total += retval;
+        } else {
+            retval = fill();
+        }
+
+        if (retval == -1) return -1;
+        if (retval == 0) break;
+    }
+
+    return total;
+}
+
+ssize_t Stream::read_until(char delim, std::string& line)
+{
+    line.clear();
+
+    while (true) {
+        size_t avail = available();
+        size_t head = rhead & (rcap - 1);
+        size_t first = std::min(avail, rcap - head);
+
+        /* the buffered data is at most two segments */
+        size_t len = 0;
+        auto* p = (const char*)memchr(&rbuf[head], delim, first);
+        if (p) {
+            len = p - &rbuf[head] + 1;
+        } else if ((p = (const char*)memchr(&rbuf[0], delim, avail - first))) {
+            len = first + (p - &rbuf[0]) + 1;
+        }
+
+        size_t n = len ? len : avail;
+        size_t offset = line.size();
+        line.resize(offset + n);
+        copy_out(&line[offset], n, true);
+
+        if (len) break;
+
+        ssize_t retval = fill();
+        if (retval == -1) return -1;
+        if (retval == 0) break;
+    }
+
+    return line.size();
+}
+
+ssize_t Stream::peek(void* buf, size_t len)
+{
+    if (len > rcap) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    while (available() < len) {
+        ssize_t retval = fill();
+        if (retval == -1) return -1;
+        if (retval == 0) {
+            len = available();
+            break;
+        }
+    }
+
+    copy_out(buf, len, false);
+
+    return len;
+}
+
+ssize_t Stream::write(const void* buf, size_t len)
+{
+    struct iovec iov = {(void*)buf, len};
+    return writev(&iov, 1);
+}
+
+ssize_t Stream::writev(const struct iovec* iov, int iovcnt)
+{
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
+
+    if (len > wcap - pending()) {
+        if (len >= wcap) {
+            /* too large to be worth copying, send it along with what is
+             * buffered in one go */
+            std::vector<struct iovec> vec;
+            vec.reserve(iovcnt + 1);
+            if (pending()) vec.push_back({&wbuf[wstart], pending()});
+            vec.insert(vec.end(), iov, iov + iovcnt);
+
+            size_t buffered = pending();
+            size_t written;
+            int retval = write_all(vec.data(), vec.size(), written);
+
+            /* what went out must not be sent again by the next call */
+            wstart += std::min(written, buffered);
+            if (wstart == wend) wstart = wend = 0;
+
+            if (retval == -1) {
+                /* the caller learns how much of its data made it */
+                if (written > buffered) return written - buffered;
+                return -1;
+            }
+
+            return len;
+        }
+
+        /* back-pressure, parks until the buffer is drained */
+        if (flush() == -1) return -1;
+    }
+
+    if (wcap - wend < len) {
+        memmove(&wbuf[0], &wbuf[wstart], pending());
+        wend -= wstart;
+        wstart = 0;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(&wbuf[wend], iov[i].iov_base, iov[i].iov_len);
+        wend += iov[i].iov_len;
+    }
+
+    return len;
+}
+
+int Stream::flush()
+{
+    if (!pending()) return 0;
+
+    struct iovec iov = {&wbuf[wstart], pending()};
+    size_t written;
+    int retval = write_all(&iov, 1, written);
+
+    wstart += written;
+    if (wstart == wend) wstart = wend = 0;
+
+    return retval;
+}
+
+int Stream::write_all(struct iovec* iov, int iovcnt, size_t& total)
+{
+    total = 0;
+
+    while (iovcnt) {
+        ssize_t n = ::writev(fd, iov, iovcnt);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        total += n;
+        while (iovcnt && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if (iovcnt) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+} // namespace coco
@@ -1,4 +1,5 @@
 #include "coco/sync/mutex.h"
+#include "coco/coop.h"
 
 namespace coco {
 
@@ -20,6 +21,9 @@ bool Mutex::try_lock()
 
 void Mutex::lock()
 {
+    /* before taking the lock, not while holding it */
+    consume_budget();
+
     if (try_lock()) return;
 
     uint8_t locked_contented = (uint8_t)LOCKED_CONTENTED;
@@ -1,4 +1,5 @@
 #include "coco/sync/shared_mutex.h"
+#include "coco/coop.h"
 
 namespace coco {
 
@@ -46,6 +47,8 @@ again:
 
 void SharedMutex::lock_shared()
 {
+    consume_budget();
+
     while (true) {
         if (try_lock_shared()) return;
 
@@ -91,6 +94,8 @@ bool SharedMutex::try_lock()
 
 void SharedMutex::lock()
 {
+    consume_budget();
+
     while (true) {
         if (try_lock()) return;
 
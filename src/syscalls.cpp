@@ -1,17 +1,51 @@
 #include "coco/syscalls.h"
+#include "coco/blocking.h"
+#include "coco/coop.h"
+#include "coco/epoch.h"
 #include "coco/io_context.h"
+#include "coco/io_poller.h"
 #include "coco/thread_context.h"
+#include "coco/zerocopy.h"
 
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 #include <poll.h>
 #include <stdarg.h>
 
+#include <chrono>
 #include <iostream>
+#include <vector>
 
 namespace coco {
 
-static void init_hook();
+/* run a call which may block for long on the blocking pool, errno is carried
+ * back to the calling task */
+template <typename F> static auto do_blocking(F fn) -> decltype(fn())
+{
+    int err = errno;
+    auto retval = blocking([&fn, &err] {
+        auto r = fn();
+        err = errno;
+        return r;
+    });
+
+    errno = err;
+    return retval;
+}
+
+/* poll sets up to this size wait without touching the heap */
+static const nfds_t POLL_INLINE_ENTRIES = 8;
+
+/* take the entries which did not fire off the wait lists of their fds */
+static void remove_poll_entries(PollEntry* entries, nfds_t nfds)
+{
+    for (nfds_t i = 0; i < nfds; i++) {
+        if (entries[i].pfd) entries[i].pfd->remove(&entries[i]);
+    }
+}
 
 static int __poll(struct pollfd* fds, nfds_t nfds, int timeout)
 {
@@ -21,40 +55,64 @@ static int __poll(struct pollfd* fds, nfds_t nfds, int timeout)
         return poll_f(fds, nfds, timeout);
     }
 
-    int retval = poll_f(fds, nfds, 0);
-    if (retval) return retval;
+    /* the entries are linked into the wait lists of the fds for as long as we
+     * are sleeping */
+    PollEntry inline_entries[POLL_INLINE_ENTRIES];
+    std::unique_ptr<PollEntry[]> heap_entries;
+    PollEntry* entries = inline_entries;
+    if (nfds > POLL_INLINE_ENTRIES) {
+        heap_entries = std::make_unique<PollEntry[]>(nfds);
+        entries = heap_entries.get();
+    }
+
+    /* go to sleep before the fds are registered so that a notification which
+     * races with the registration does not get lost. a sleeping task is not
+     * preempted, so it stays on the thread we look up from here on */
+    ThreadContext::set_sleep(ParkReason::IO, nfds ? fds[0].fd : -1);
 
-    auto revents =
-        std::make_unique<short[]>(nfds); // alive for as long as we are sleeping
+    auto* thread = ThreadContext::get_current_thread();
+    auto* poller = thread->get_io_poller();
 
-    bool added = false;
-    for (int i = 0; i < nfds; i++) {
+    bool pollable = true;
+    for (nfds_t i = 0; i < nfds; i++) {
         struct pollfd* p = &fds[i];
-        if (p->fd < 0) continue;
         p->revents = 0;
+        if (p->fd < 0) continue;
 
-        bool ret = ThreadContext::get_current_io_poller()->add(
-            p->fd, p->events, task, &revents.get()[i]);
-
-        added |= ret;
+        entries[i].task = task;
+        entries[i].events = p->events;
+        if (!poller->add(p->fd, &entries[i])) {
+            pollable = false;
+            break;
+        }
     }
 
-    if (!added) {
-        for (int i = 0; i < nfds; i++) {
-            fds[i].revents = POLLNVAL;
-        }
-        errno = 0;
-        return nfds;
+    if (!pollable) {
+        /* fds we do not track (or regular files) are polled by a helper
+         * thread instead */
+        thread->wake_up(task);
+        remove_poll_entries(entries, nfds);
+
+        return do_blocking(
+            [fds, nfds, timeout] { return poll_f(fds, nfds, timeout); });
     }
 
-    ThreadContext::sleep();
+    Timer timer(Clock::now() + std::chrono::milliseconds(timeout), thread,
+                task);
+    if (timeout > 0) thread->add_timer(&timer);
+
+    ThreadContext::yield();
+
+    if (timeout > 0) thread->remove_timer(&timer);
+
+    /* whichever fd woke us up, the others are still queued */
+    remove_poll_entries(entries, nfds);
 
     int n = 0;
-    for (int i = 0; i < nfds; i++) {
-        fds[i].revents = revents[i];
+    for (nfds_t i = 0; i < nfds; i++) {
+        fds[i].revents = entries[i].revents;
         if (fds[i].revents) n++;
     }
-    errno = 0;
     return n;
 }
 
@@ -70,36 +128,470 @@ static typename std::result_of<F(int, Args...)>::type safe_rdwt(F fn, int fd,
     return retval;
 }
 
+/* park until fd becomes ready, returns 0 on timeout */
+static int wait_fd(int fd, short events, int timeout)
+{
+    struct pollfd fds;
+    fds.fd = fd;
+    fds.events = events;
+
+    int retval;
+    do {
+        fds.revents = 0;
+        if (ThreadContext::get_current_task()) {
+            retval = __poll(&fds, 1, timeout);
+        } else {
+            retval = poll_f(&fds, 1, timeout);
+        }
+    } while (retval == -1 && errno == EINTR);
+
+    if (retval > 0 && (fds.revents & POLLNVAL)) {
+        /* the fd was closed while we were waiting on it */
+        errno = EBADF;
+        return -1;
+    }
+
+    return retval;
+}
+
+/* round up so that we never wake up before the timeout */
+static int timespec_to_ms(const struct timespec* ts)
+{
+    if (!ts) return -1;
+
+    int64_t ms = (int64_t)ts->tv_sec * 1000 + (ts->tv_nsec + 999999) / 1000000;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+static int do_select(int nfds, fd_set* readfds, fd_set* writefds,
+                     fd_set* exceptfds, int timeout)
+{
+    std::vector<struct pollfd> fds;
+    for (int fd = 0; fd < nfds; fd++) {
+        short events = 0;
+        if (readfds && FD_ISSET(fd, readfds)) events |= POLLIN;
+        if (writefds && FD_ISSET(fd, writefds)) events |= POLLOUT;
+        if (exceptfds && FD_ISSET(fd, exceptfds)) events |= POLLPRI;
+
+        if (events) fds.push_back({fd, events, 0});
+    }
+
+    int retval = __poll(fds.data(), fds.size(), timeout);
+    if (retval == -1) return -1;
+
+    for (auto&& p : fds) {
+        if (p.revents & POLLNVAL) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+
+    if (readfds) FD_ZERO(readfds);
+    if (writefds) FD_ZERO(writefds);
+    if (exceptfds) FD_ZERO(exceptfds);
+
+    int n = 0;
+    for (auto&& p : fds) {
+        if ((p.events & POLLIN) && (p.revents & (POLLIN | POLLHUP | POLLERR))) {
+            FD_SET(p.fd, readfds);
+            n++;
+        }
+        if ((p.events & POLLOUT) && (p.revents & (POLLOUT | POLLERR))) {
+            FD_SET(p.fd, writefds);
+            n++;
+        }
+        if ((p.events & POLLPRI) && (p.revents & POLLPRI)) {
+            FD_SET(p.fd, exceptfds);
+            n++;
+        }
+    }
+
+    return n;
+}
+
+static int do_epoll_wait(int epfd, struct epoll_event* events, int maxevents,
+                         int timeout)
+{
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout);
+
+    while (true) {
+        int retval = epoll_wait_f(epfd, events, maxevents, 0);
+        if (retval != 0) return retval;
+
+        int remaining = -1;
+        if (timeout > 0) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                deadline - Clock::now());
+            if (left.count() <= 0) return 0;
+
+            remaining = left.count();
+        }
+
+        /* the epoll fd is readable when it has events to report. it is not
+         * created through the hooks and we leave it alone (no O_NONBLOCK, no
+         * registration), so the wait goes to the blocking pool */
+        retval = wait_fd(epfd, POLLIN, remaining);
+        if (retval <= 0) return retval;
+    }
+}
+
 template <typename F, typename... Args>
 static typename std::result_of<F(int, Args...)>::type
-do_rdwt(int fd, F fn, short event, int timeout, ssize_t count, Args&&... args)
+do_rdwt(int fd, F fn, short event, int timeout, Args... args)
+{
+    bool hooked, pollable, user_nonblock;
+    {
+        EpochGuard guard;
+        auto* pfd = IOContext::get_instance().get_pfd(fd);
+
+        hooked = pfd != nullptr;
+        pollable = hooked && pfd->is_pollable();
+        user_nonblock = hooked && pfd->is_user_nonblock();
+    }
+
+    if (!hooked) {
+        return safe_rdwt(fn, fd, args...);
+    }
+
+    if (!pollable) {
+        /* fds which epoll does not support are regular files (or alike)
+         * which never return EAGAIN but can block on the disk */
+        return do_blocking([&] { return safe_rdwt(fn, fd, args...); });
+    }
+
+    /* the task parks only when the fd is not ready */
+    consume_budget();
+
+    if (user_nonblock) {
+        return safe_rdwt(fn, fd, args...);
+    }
+
+    while (true) {
+        /* the fd is non-blocking under the hood so try the syscall first and
+         * only wait for readiness when it would block */
+        auto retval = safe_rdwt(fn, fd, args...);
+        if (retval != -1 || errno != EAGAIN) {
+            return retval;
+        }
+
+        retval = wait_fd(fd, event, timeout);
+        if (retval == -1) return -1;
+
+        if (retval == 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+}
+
+/* hand the operation to the poller if it can perform it asynchronously
+ * (io_uring), returns false if the caller should fall back to do_rdwt. only
+ * fds epoll can not wait for go to the ring, e.g. regular files which would
+ * take a blocking pool thread otherwise. the others are usually ready and
+ * do_rdwt() serves them without parking */
+static bool do_submit(ssize_t& retval, int fd, IORequest::Op op, void* addr,
+                      uint64_t len, int flags = 0, uint64_t addr2 = 0,
+                      int timeout = -1)
 {
     auto task = ThreadContext::get_current_task();
+    if (!task) return false;
+
+    auto* poller = ThreadContext::get_current_io_poller();
+    if (!poller->can_submit()) return false;
 
-    if (!task) {
-        return fn(fd, std::forward<Args>(args)...);
+    /* the request refers to the pfd until it completes, which may well be
+     * after the fd is closed */
+    PPFd pfd;
+    {
+        EpochGuard guard;
+        pfd = PPFd(IOContext::get_instance().get_pfd(fd));
     }
 
-    struct pollfd fds;
-    fds.fd = fd;
-    fds.events = event;
-    fds.revents = 0;
+    /* users who asked for O_NONBLOCK expect EAGAIN instead of waiting */
+    if (!pfd || pfd->is_pollable() || pfd->is_user_nonblock()) return false;
+
+    IORequest req(op, pfd.get(), addr, len, flags, timeout);
+    req.addr2 = addr2;
+
+    ThreadContext::set_sleep(ParkReason::IO, fd);
+
+    /* the task may have been preempted and moved since the check above */
+    poller = ThreadContext::get_current_io_poller();
+    if (!poller->submit(task, &req)) {
+        ThreadContext::get_current_thread()->wake_up(task);
+        return false;
+    }
+
+    ThreadContext::yield();
+
+    /* some kernels honor O_NONBLOCK on the file, wait for readiness the usual
+     * way instead */
+    if (req.result == -EAGAIN) return false;
+
+    if (req.result == -ECANCELED) {
+        /* either timed out or the fd was closed while the operation was in
+         * flight */
+        errno = pfd->is_closed() ? EBADF : EAGAIN;
+        retval = -1;
+    } else if (req.result < 0) {
+        errno = -req.result;
+        retval = -1;
+    } else {
+        retval = req.result;
+    }
+
+    return true;
+}
+
+template <typename F>
+static int do_accept(F fn, int fd, struct sockaddr* addr, socklen_t* addrlen,
+                     int flags)
+{
+    ssize_t retval;
+    if (!do_submit(retval, fd, IORequest::Op::ACCEPT, addr, 0, flags,
+                   (uint64_t)addrlen)) {
+        retval = do_rdwt(fd, fn, POLLIN, -1, addr, addrlen, flags);
+    }
+
+    if (retval >= 0) {
+        IOContext::get_instance().create_pfd(retval);
+    }
+
+    return retval;
+}
+
+static int do_connect(int fd, const struct sockaddr* addr, socklen_t addrlen)
+{
+    int retval = connect_f(fd, addr, addrlen);
+    if (retval == 0 || errno != EINPROGRESS) {
+        return retval;
+    }
 
-retry:
-    int retval = __poll(&fds, 1, timeout);
-    if (retval == -1) {
-        if (errno == EINTR) {
-            goto retry;
+    {
+        EpochGuard guard;
+        auto* pfd = IOContext::get_instance().get_pfd(fd);
+        if (!pfd || !pfd->is_pollable() || pfd->is_user_nonblock()) {
+            return retval;
         }
+    }
+
+    /* wait for the connection to complete like a blocking connect would */
+    retval = wait_fd(fd, POLLOUT, -1);
+    if (retval == -1) return -1;
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
         return -1;
     }
 
-    if (retval == 0) {
-        errno = EAGAIN;
+    if (err) {
+        errno = err;
         return -1;
     }
 
-    return safe_rdwt(fn, fd, std::forward<Args>(args)...);
+    return 0;
+}
+
+/* sendfile, splice and tee move data between two fds, either of which may be
+ * the one that would block */
+template <typename F>
+static ssize_t do_transfer(int fd_in, int fd_out, bool nonblock, F fn)
+{
+    struct pollfd fds[2];
+    nfds_t nfds = 0;
+    bool blocking_end = false;
+    {
+        EpochGuard guard;
+        auto& io_ctx = IOContext::get_instance();
+
+        for (auto&& p : {std::make_pair(fd_in, (short)POLLIN),
+                         std::make_pair(fd_out, (short)POLLOUT)}) {
+            auto* pfd = io_ctx.get_pfd(p.first);
+            if (!pfd) continue;
+
+            nonblock |= pfd->is_user_nonblock();
+            if (pfd->is_pollable()) {
+                fds[nfds].fd = p.first;
+                fds[nfds].events = p.second;
+                nfds++;
+            } else {
+                blocking_end = true;
+            }
+        }
+    }
+
+    auto attempt = [&fn] {
+        ssize_t retval;
+        do {
+            retval = fn();
+        } while (retval == -1 && errno == EINTR);
+
+        return retval;
+    };
+
+    if (nonblock || (!nfds && !blocking_end)) {
+        return attempt();
+    }
+
+    while (true) {
+        /* the regular file end may block on the disk */
+        ssize_t retval;
+        if (blocking_end) {
+            retval = do_blocking(attempt);
+        } else {
+            retval = attempt();
+        }
+
+        if (retval != -1 || errno != EAGAIN || !nfds) {
+            return retval;
+        }
+
+        /* we can not tell which end would block so wait for either */
+        int ready;
+        do {
+            fds[0].revents = fds[1].revents = 0;
+            if (ThreadContext::get_current_task()) {
+                ready = __poll(fds, nfds, -1);
+            } else {
+                ready = poll_f(fds, nfds, -1);
+            }
+        } while (ready == -1 && errno == EINTR);
+
+        if (ready == -1) return -1;
+
+        for (nfds_t i = 0; i < nfds; i++) {
+            if (fds[i].revents & POLLNVAL) {
+                errno = EBADF;
+                return -1;
+            }
+        }
+    }
+}
+
+/* drain zero-copy completions from the error queue, returns whether the send
+ * numbered id has been released */
+static bool reap_zerocopy(int fd, PollableFileDesc* pfd, ZeroCopyState* zc,
+                          uint32_t id)
+{
+    /* cleared before draining so that a completion which arrives meanwhile
+     * sets it again */
+    pfd->clear_ready(POLLERR);
+
+    while (true) {
+        char control[128];
+        struct msghdr msg = {};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg_f(fd, &msg, MSG_ERRQUEUE) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            bool is_ip_err = cmsg->cmsg_level == SOL_IP &&
+                             cmsg->cmsg_type == IP_RECVERR;
+            bool is_ipv6_err = cmsg->cmsg_level == SOL_IPV6 &&
+                               cmsg->cmsg_type == IPV6_RECVERR;
+            if (!is_ip_err && !is_ipv6_err) continue;
+
+            auto* err = (struct sock_extended_err*)CMSG_DATA(cmsg);
+            if (err->ee_errno || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+
+            /* [ee_info, ee_data] have been released. completions of a
+             * stream socket arrive in order */
+            std::lock_guard<PreemptMutex> lock(zc->mutex);
+            if ((int32_t)(err->ee_data + 1 - zc->completed) > 0) {
+                zc->completed = err->ee_data + 1;
+            }
+        }
+    }
+
+    std::lock_guard<PreemptMutex> lock(zc->mutex);
+    return (int32_t)(zc->completed - id) > 0;
+}
+
+/* the completion of our send may be reaped by another task sending on the
+ * same socket, so do not rely on POLLERR alone */
+static const int ZEROCOPY_REAP_INTERVAL = 10;
+
+ssize_t send_zerocopy(int fd, const void* buf, size_t len, int flags)
+{
+    init_hook();
+
+    PPFd pfd;
+    {
+        EpochGuard guard;
+        pfd = PPFd(IOContext::get_instance().get_pfd(fd));
+    }
+
+    if (!len || !pfd || !pfd->is_pollable()) {
+        return ::send(fd, buf, len, flags);
+    }
+
+    auto* zc = pfd->get_zerocopy();
+    {
+        std::lock_guard<PreemptMutex> lock(zc->mutex);
+
+        if (!zc->enabled) {
+            int one = 1;
+            zc->enabled = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one,
+                                     sizeof(one)) == 0;
+        }
+    }
+
+    if (!zc->enabled) {
+        return ::send(fd, buf, len, flags);
+    }
+
+    bool nonblock = pfd->is_user_nonblock() || (flags & MSG_DONTWAIT);
+
+    ssize_t retval;
+    uint32_t id;
+    while (true) {
+        {
+            std::lock_guard<PreemptMutex> lock(zc->mutex);
+
+            retval = send_f(fd, buf, len, flags | MSG_ZEROCOPY);
+            if (retval != -1) {
+                id = zc->next++;
+                break;
+            }
+        }
+
+        if (errno == EINTR) continue;
+
+        if (errno == ENOBUFS) {
+            /* too many sends are waiting to be released */
+            uint32_t last;
+            {
+                std::lock_guard<PreemptMutex> lock(zc->mutex);
+                if (zc->next == zc->completed) return -1;
+                last = zc->next - 1;
+            }
+
+            if (!reap_zerocopy(fd, pfd.get(), zc, last)) {
+                wait_fd(fd, POLLERR, ZEROCOPY_REAP_INTERVAL);
+            }
+            continue;
+        }
+
+        if (errno != EAGAIN || nonblock) return -1;
+
+        if (wait_fd(fd, POLLOUT, -1) == -1) return -1;
+    }
+
+    /* buf belongs to the kernel until the send is released, it may still be
+     * in use when we can no longer wait for that, e.g. after a close */
+    while (!reap_zerocopy(fd, pfd.get(), zc, id)) {
+        if (wait_fd(fd, POLLERR, ZEROCOPY_REAP_INTERVAL) == -1) return -1;
+    }
+
+    return retval;
 }
 
 } // namespace coco
@@ -108,9 +600,36 @@ extern "C"
 {
     open_t open_f = nullptr;
     pipe_t pipe_f = nullptr;
+    socket_t socket_f = nullptr;
+    socketpair_t socketpair_f = nullptr;
+    accept4_t accept4_f = nullptr;
+    connect_t connect_f = nullptr;
+    close_t close_f = nullptr;
     read_t read_f = nullptr;
     write_t write_f = nullptr;
+    readv_t readv_f = nullptr;
+    writev_t writev_f = nullptr;
+    recv_t recv_f = nullptr;
+    recvfrom_t recvfrom_f = nullptr;
+    recvmsg_t recvmsg_f = nullptr;
+    send_t send_f = nullptr;
+    sendto_t sendto_f = nullptr;
+    sendmsg_t sendmsg_f = nullptr;
+    sendfile_t sendfile_f = nullptr;
+    splice_t splice_f = nullptr;
+    tee_t tee_f = nullptr;
+    copy_file_range_t copy_file_range_f = nullptr;
+    fsync_t fsync_f = nullptr;
+    fdatasync_t fdatasync_f = nullptr;
+    stat_t stat_f = nullptr;
+    lstat_t lstat_f = nullptr;
+    getaddrinfo_t getaddrinfo_f = nullptr;
     poll_t poll_f = nullptr;
+    ppoll_t ppoll_f = nullptr;
+    select_t select_f = nullptr;
+    pselect_t pselect_f = nullptr;
+    epoll_wait_t epoll_wait_f = nullptr;
+    fcntl_t fcntl_f = nullptr;
 
     int open(const char* pathname, int flags, ...)
     {
@@ -150,16 +669,424 @@ extern "C"
         return retval;
     }
 
+    int socket(int domain, int type, int protocol)
+    {
+        if (!socket_f) coco::init_hook();
+
+        int retval = socket_f(domain, type, protocol);
+        if (retval >= 0) {
+            coco::IOContext::get_instance().create_pfd(retval);
+        }
+
+        return retval;
+    }
+
+    int socketpair(int domain, int type, int protocol, int sv[2])
+    {
+        if (!socketpair_f) coco::init_hook();
+
+        int retval = socketpair_f(domain, type, protocol, sv);
+        if (!retval) {
+            coco::IOContext::get_instance().create_pfd(sv[0]);
+            coco::IOContext::get_instance().create_pfd(sv[1]);
+        }
+
+        return retval;
+    }
+
+    int accept(int fd, struct sockaddr* addr, socklen_t* addrlen)
+    {
+        if (!accept4_f) coco::init_hook();
+
+        /* accept() is accept4() without flags */
+        return coco::do_accept(accept4_f, fd, addr, addrlen, 0);
+    }
+
+    int accept4(int fd, struct sockaddr* addr, socklen_t* addrlen, int flags)
+    {
+        if (!accept4_f) coco::init_hook();
+        return coco::do_accept(accept4_f, fd, addr, addrlen, flags);
+    }
+
+    int connect(int fd, const struct sockaddr* addr, socklen_t addrlen)
+    {
+        if (!connect_f) coco::init_hook();
+        return coco::do_connect(fd, addr, addrlen);
+    }
+
+    int close(int fd)
+    {
+        if (!close_f) coco::init_hook();
+
+        /* deregister before the fd number can be reused */
+        coco::IOContext::get_instance().remove_pfd(fd);
+
+        return close_f(fd);
+    }
+
     ssize_t read(int fd, void* buf, size_t count)
     {
         if (!read_f) coco::init_hook();
-        return coco::do_rdwt(fd, read_f, POLLIN, -1, count, buf, count);
+
+        ssize_t retval;
+        if (coco::do_submit(retval, fd, coco::IORequest::Op::READ, buf,
+                            count)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, read_f, POLLIN, -1, buf, count);
     }
 
     ssize_t write(int fd, const void* buf, size_t count)
     {
         if (!write_f) coco::init_hook();
-        return coco::do_rdwt(fd, write_f, POLLOUT, -1, count, buf, count);
+
+        ssize_t retval;
+        if (coco::do_submit(retval, fd, coco::IORequest::Op::WRITE,
+                            (void*)buf, count)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, write_f, POLLOUT, -1, buf, count);
+    }
+
+    ssize_t readv(int fd, const struct iovec* iov, int iovcnt)
+    {
+        if (!readv_f) coco::init_hook();
+
+        ssize_t retval;
+        if (coco::do_submit(retval, fd, coco::IORequest::Op::READV,
+                            (void*)iov, iovcnt)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, readv_f, POLLIN, -1, iov, iovcnt);
+    }
+
+    ssize_t writev(int fd, const struct iovec* iov, int iovcnt)
+    {
+        if (!writev_f) coco::init_hook();
+
+        ssize_t retval;
+        if (coco::do_submit(retval, fd, coco::IORequest::Op::WRITEV,
+                            (void*)iov, iovcnt)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, writev_f, POLLOUT, -1, iov, iovcnt);
+    }
+
+    ssize_t recv(int fd, void* buf, size_t len, int flags)
+    {
+        if (!recv_f) coco::init_hook();
+        if (flags & (MSG_DONTWAIT | MSG_ERRQUEUE)) {
+            return recv_f(fd, buf, len, flags);
+        }
+
+        ssize_t retval;
+        if (coco::do_submit(retval, fd, coco::IORequest::Op::RECV, buf, len,
+                            flags)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, recv_f, POLLIN, -1, buf, len, flags);
+    }
+
+    ssize_t recvfrom(int fd, void* buf, size_t len, int flags,
+                     struct sockaddr* src_addr, socklen_t* addrlen)
+    {
+        if (!recvfrom_f) coco::init_hook();
+        if (flags & (MSG_DONTWAIT | MSG_ERRQUEUE)) {
+            return recvfrom_f(fd, buf, len, flags, src_addr, addrlen);
+        }
+
+        ssize_t retval;
+        if (!src_addr && coco::do_submit(retval, fd, coco::IORequest::Op::RECV,
+                                         buf, len, flags)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, recvfrom_f, POLLIN, -1, buf, len, flags,
+                             src_addr, addrlen);
+    }
+
+    ssize_t recvmsg(int fd, struct msghdr* msg, int flags)
+    {
+        if (!recvmsg_f) coco::init_hook();
+        /* the error queue never blocks */
+        if (flags & (MSG_DONTWAIT | MSG_ERRQUEUE)) {
+            return recvmsg_f(fd, msg, flags);
+        }
+
+        ssize_t retval;
+        if (coco::do_submit(retval, fd, coco::IORequest::Op::RECVMSG, msg, 1,
+                            flags)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, recvmsg_f, POLLIN, -1, msg, flags);
+    }
+
+    ssize_t send(int fd, const void* buf, size_t len, int flags)
+    {
+        if (!send_f) coco::init_hook();
+        if (flags & MSG_DONTWAIT) return send_f(fd, buf, len, flags);
+
+        ssize_t retval;
+        if (coco::do_submit(retval, fd, coco::IORequest::Op::SEND, (void*)buf,
+                            len, flags)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, send_f, POLLOUT, -1, buf, len, flags);
+    }
+
+    ssize_t sendto(int fd, const void* buf, size_t len, int flags,
+                   const struct sockaddr* dest_addr, socklen_t addrlen)
+    {
+        if (!sendto_f) coco::init_hook();
+        if (flags & MSG_DONTWAIT) {
+            return sendto_f(fd, buf, len, flags, dest_addr, addrlen);
+        }
+
+        ssize_t retval;
+        if (!dest_addr &&
+            coco::do_submit(retval, fd, coco::IORequest::Op::SEND, (void*)buf,
+                            len, flags)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, sendto_f, POLLOUT, -1, buf, len, flags,
+                             dest_addr, addrlen);
+    }
+
+    ssize_t sendmsg(int fd, const struct msghdr* msg, int flags)
+    {
+        if (!sendmsg_f) coco::init_hook();
+        if (flags & MSG_DONTWAIT) return sendmsg_f(fd, msg, flags);
+
+        ssize_t retval;
+        if (coco::do_submit(retval, fd, coco::IORequest::Op::SENDMSG,
+                            (void*)msg, 1, flags)) {
+            return retval;
+        }
+
+        return coco::do_rdwt(fd, sendmsg_f, POLLOUT, -1, msg, flags);
+    }
+
+    ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count)
+    {
+        if (!sendfile_f) coco::init_hook();
+        return coco::do_transfer(in_fd, out_fd, false, [=] {
+            return sendfile_f(out_fd, in_fd, offset, count);
+        });
+    }
+
+    ssize_t splice(int fd_in, loff_t* off_in, int fd_out, loff_t* off_out,
+                   size_t len, unsigned int flags)
+    {
+        if (!splice_f) coco::init_hook();
+        return coco::do_transfer(fd_in, fd_out, flags & SPLICE_F_NONBLOCK, [=] {
+            return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+        });
+    }
+
+    ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags)
+    {
+        if (!tee_f) coco::init_hook();
+        return coco::do_transfer(fd_in, fd_out, flags & SPLICE_F_NONBLOCK, [=] {
+            return tee_f(fd_in, fd_out, len, flags);
+        });
+    }
+
+    ssize_t copy_file_range(int fd_in, loff_t* off_in, int fd_out,
+                            loff_t* off_out, size_t len, unsigned int flags)
+    {
+        if (!copy_file_range_f) coco::init_hook();
+
+        /* both ends are regular files */
+        return coco::do_blocking([=] {
+            return copy_file_range_f(fd_in, off_in, fd_out, off_out, len,
+                                     flags);
+        });
+    }
+
+    int fsync(int fd)
+    {
+        if (!fsync_f) coco::init_hook();
+        return coco::do_blocking([fd] { return fsync_f(fd); });
+    }
+
+    int fdatasync(int fd)
+    {
+        if (!fdatasync_f) coco::init_hook();
+        return coco::do_blocking([fd] { return fdatasync_f(fd); });
+    }
+
+    int stat(const char* pathname, struct stat* statbuf)
+    {
+        if (!stat_f) coco::init_hook();
+        return coco::do_blocking(
+            [pathname, statbuf] { return stat_f(pathname, statbuf); });
+    }
+
+    int lstat(const char* pathname, struct stat* statbuf)
+    {
+        if (!lstat_f) coco::init_hook();
+        return coco::do_blocking(
+            [pathname, statbuf] { return lstat_f(pathname, statbuf); });
+    }
+
+    int getaddrinfo(const char* node, const char* service,
+                    const struct addrinfo* hints, struct addrinfo** res)
+    {
+        if (!getaddrinfo_f) coco::init_hook();
+
+        /* name resolution may go out to the network */
+        return coco::do_blocking([node, service, hints, res] {
+            return getaddrinfo_f(node, service, hints, res);
+        });
+    }
+
+    int poll(struct pollfd* fds, nfds_t nfds, int timeout)
+    {
+        if (!poll_f) coco::init_hook();
+        return coco::__poll(fds, nfds, timeout);
+    }
+
+    int ppoll(struct pollfd* fds, nfds_t nfds, const struct timespec* tmo_p,
+              const sigset_t* sigmask)
+    {
+        if (!ppoll_f) coco::init_hook();
+
+        if (!coco::ThreadContext::get_current_task()) {
+            return ppoll_f(fds, nfds, tmo_p, sigmask);
+        }
+
+        /* the signal mask belongs to the worker thread which is shared with
+         * other tasks, apply it on a helper thread instead */
+        if (sigmask) {
+            return coco::do_blocking([fds, nfds, tmo_p, sigmask] {
+                return ppoll_f(fds, nfds, tmo_p, sigmask);
+            });
+        }
+
+        return coco::__poll(fds, nfds, coco::timespec_to_ms(tmo_p));
+    }
+
+    int select(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds,
+               struct timeval* timeout)
+    {
+        if (!select_f) coco::init_hook();
+
+        if (!coco::ThreadContext::get_current_task() || nfds < 0 ||
+            nfds > FD_SETSIZE) {
+            return select_f(nfds, readfds, writefds, exceptfds, timeout);
+        }
+
+        int timeout_ms = -1;
+        if (timeout) {
+            struct timespec ts;
+            ts.tv_sec = timeout->tv_sec;
+            ts.tv_nsec = timeout->tv_usec * 1000;
+            timeout_ms = coco::timespec_to_ms(&ts);
+        }
+
+        auto start = coco::Clock::now();
+        int retval =
+            coco::do_select(nfds, readfds, writefds, exceptfds, timeout_ms);
+
+        if (timeout && retval != -1) {
+            /* like Linux, report the time left */
+            using std::chrono::microseconds;
+            auto elapsed = std::chrono::duration_cast<microseconds>(
+                               coco::Clock::now() - start)
+                               .count();
+            int64_t left = (int64_t)timeout->tv_sec * 1000000 +
+                           timeout->tv_usec - elapsed;
+            if (left < 0) left = 0;
+
+            timeout->tv_sec = left / 1000000;
+            timeout->tv_usec = left % 1000000;
+        }
+
+        return retval;
+    }
+
+    int pselect(int nfds, fd_set* readfds, fd_set* writefds, fd_set* exceptfds,
+                const struct timespec* timeout, const sigset_t* sigmask)
+    {
+        if (!pselect_f) coco::init_hook();
+
+        if (!coco::ThreadContext::get_current_task() || nfds < 0 ||
+            nfds > FD_SETSIZE) {
+            return pselect_f(nfds, readfds, writefds, exceptfds, timeout,
+                             sigmask);
+        }
+
+        if (sigmask) {
+            return coco::do_blocking(
+                [nfds, readfds, writefds, exceptfds, timeout, sigmask] {
+                    return pselect_f(nfds, readfds, writefds, exceptfds,
+                                     timeout, sigmask);
+                });
+        }
+
+        return coco::do_select(nfds, readfds, writefds, exceptfds,
+                               coco::timespec_to_ms(timeout));
+    }
+
+    int epoll_wait(int epfd, struct epoll_event* events, int maxevents,
+                   int timeout)
+    {
+        if (!epoll_wait_f) coco::init_hook();
+
+        if (!coco::ThreadContext::get_current_task() || timeout == 0) {
+            return epoll_wait_f(epfd, events, maxevents, timeout);
+        }
+
+        return coco::do_epoll_wait(epfd, events, maxevents, timeout);
+    }
+
+    int fcntl(int fd, int cmd, ...)
+    {
+        if (!fcntl_f) coco::init_hook();
+
+        va_list parg;
+        va_start(parg, cmd);
+        void* arg = va_arg(parg, void*);
+        va_end(parg);
+
+        switch (cmd) {
+        case F_GETFL: {
+            int retval = fcntl_f(fd, cmd);
+            if (retval == -1) return retval;
+
+            /* hide the O_NONBLOCK we set behind the user's back */
+            coco::EpochGuard guard;
+            auto* pfd = coco::IOContext::get_instance().get_pfd(fd);
+            if (pfd && !pfd->is_user_nonblock()) {
+                retval &= ~O_NONBLOCK;
+            }
+
+            return retval;
+        }
+        case F_SETFL: {
+            int flags = (int)(intptr_t)arg;
+            coco::EpochGuard guard;
+            auto* pfd = coco::IOContext::get_instance().get_pfd(fd);
+            if (!pfd) return fcntl_f(fd, cmd, flags);
+
+            int retval = fcntl_f(fd, cmd, flags | O_NONBLOCK);
+            if (!retval) {
+                pfd->set_user_nonblock(flags & O_NONBLOCK);
+            }
+
+            return retval;
+        }
+        default:
+            return fcntl_f(fd, cmd, arg);
+        }
     }
 }
 
@@ -171,14 +1098,42 @@ static void init_hook()
 {
     open_f = (open_t)dlsym(RTLD_NEXT, "open");
     pipe_f = (pipe_t)dlsym(RTLD_NEXT, "pipe");
+    socket_f = (socket_t)dlsym(RTLD_NEXT, "socket");
+    socketpair_f = (socketpair_t)dlsym(RTLD_NEXT, "socketpair");
+    accept4_f = (accept4_t)dlsym(RTLD_NEXT, "accept4");
+    connect_f = (connect_t)dlsym(RTLD_NEXT, "connect");
+    close_f = (close_t)dlsym(RTLD_NEXT, "close");
     read_f = (read_t)dlsym(RTLD_NEXT, "read");
     write_f = (write_t)dlsym(RTLD_NEXT, "write");
+    readv_f = (readv_t)dlsym(RTLD_NEXT, "readv");
+    writev_f = (writev_t)dlsym(RTLD_NEXT, "writev");
+    recv_f = (recv_t)dlsym(RTLD_NEXT, "recv");
+    recvfrom_f = (recvfrom_t)dlsym(RTLD_NEXT, "recvfrom");
+    recvmsg_f = (recvmsg_t)dlsym(RTLD_NEXT, "recvmsg");
+    send_f = (send_t)dlsym(RTLD_NEXT, "send");
+    sendto_f = (sendto_t)dlsym(RTLD_NEXT, "sendto");
+    sendmsg_f = (sendmsg_t)dlsym(RTLD_NEXT, "sendmsg");
+    sendfile_f = (sendfile_t)dlsym(RTLD_NEXT, "sendfile");
+    splice_f = (splice_t)dlsym(RTLD_NEXT, "splice");
+    tee_f = (tee_t)dlsym(RTLD_NEXT, "tee");
+    copy_file_range_f =
+        (copy_file_range_t)dlsym(RTLD_NEXT, "copy_file_range");
+    fsync_f = (fsync_t)dlsym(RTLD_NEXT, "fsync");
+    fdatasync_f = (fdatasync_t)dlsym(RTLD_NEXT, "fdatasync");
+    stat_f = (stat_t)dlsym(RTLD_NEXT, "stat");
+    lstat_f = (lstat_t)dlsym(RTLD_NEXT, "lstat");
+    getaddrinfo_f = (getaddrinfo_t)dlsym(RTLD_NEXT, "getaddrinfo");
     poll_f = (poll_t)dlsym(RTLD_NEXT, "poll");
+    ppoll_f = (ppoll_t)dlsym(RTLD_NEXT, "ppoll");
+    select_f = (select_t)dlsym(RTLD_NEXT, "select");
+    pselect_f = (pselect_t)dlsym(RTLD_NEXT, "pselect");
+    epoll_wait_f = (epoll_wait_t)dlsym(RTLD_NEXT, "epoll_wait");
+    fcntl_f = (fcntl_t)dlsym(RTLD_NEXT, "fcntl");
 }
 
 } // namespace detail
 
-static void init_hook()
+void init_hook()
 {
     static bool inited = false;
     if (!inited) {
@@ -1,51 +1,205 @@
 #include "coco/task.h"
+#include "coco/growable_stack.h"
 #include "coco/scheduler.h"
+#include "coco/stack_profile.h"
+#include "coco/tsc.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <sys/mman.h>
 
 namespace coco {
 
-Task::Task(std::function<void()>&& func, size_t stacksize)
-    : func(func), stacksize(stacksize), state(State::RUNNABLE), eptr(nullptr)
+static std::atomic<uint64_t> next_task_id{1};
+
+Task::Task(std::function<void()>&& func, size_t stacksize,
+           TaskClass* task_class)
+    : id(next_task_id.fetch_add(1, std::memory_order_relaxed)), refs(1),
+      func(func), stacksize(stacksize), stack_painted(false),
+      stack_mapped(false), stack_low(0), stack_top(0),
+      state(State::RUNNABLE), on_cpu(false),
+      eptr(nullptr),
+      task_class(task_class ? task_class : TaskClass::get(nullptr)),
+      runnable_tsc(rdtsc()), slice_tsc(0), park_reason(ParkReason::OTHER),
+      park_arg(0)
+{
+    this->stacksize = this->task_class->get_stack_size(stacksize);
+    init_stack(this->stacksize);
+}
+
+void StackDeleter::operator()(uint8_t* p) const
 {
-    init_stack(stacksize);
+    if (mapped_size) {
+        munmap(p, mapped_size);
+    } else {
+        delete[] p;
+    }
 }
 
 void Task::init_stack(size_t stacksize)
 {
-    stack = std::make_unique<uint8_t[]>(stacksize + STACK_GUARD_SIZE);
-    auto stacktop = stack.get() + stacksize + STACK_GUARD_SIZE;
+    stack_painted = is_stack_painting_enabled();
+
+    if (is_growable_stacks_enabled()) {
+        init_growable_stack(stacksize);
+    } else if (stack_painted) {
+        /* painting touches every page anyway, skip the zeroing */
+        stack.reset(new uint8_t[stacksize + STACK_GUARD_SIZE]);
+        memset(stack.get(), STACK_PAINT, stacksize + STACK_GUARD_SIZE);
+    } else {
+        stack.reset(new uint8_t[stacksize + STACK_GUARD_SIZE]());
+    }
+
+    reg_t stacktop = (reg_t)stack.get() + stacksize + STACK_GUARD_SIZE;
+
+    /* the entry trampoline calls Task::run() right above the frame, the stack
+     * has to be 16-byte aligned at that call */
+    auto* frame = (StackFrame*)((stacktop & ~(reg_t)0xf) - sizeof(StackFrame));
+    memset(frame, 0, sizeof(StackFrame));
+
+    frame->rdi = (reg_t)this;
+    frame->r12 = (reg_t)&Task::run;
+    frame->rip = (reg_t)task_class->get_entry();
+
+    sp = (reg_t)frame;
+}
+
+void Task::init_growable_stack(size_t stacksize)
+{
+    const size_t page_mask = STACK_GUARD_SIZE - 1;
+    size_t size = (stacksize + STACK_GUARD_SIZE + page_mask) & ~page_mask;
+
+    /* nothing is charged for the reservation, the lowest page stays
+     * inaccessible for good as the guard */
+    void* p = mmap(nullptr, size, PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("failed to reserve coroutine stack");
+    }
+
+    stack = std::unique_ptr<uint8_t[], StackDeleter>((uint8_t*)p,
+                                                     StackDeleter{size});
+    stack_mapped = true;
+    stack_top = (uintptr_t)p + size;
+    stack_low = stack_top;
+
+    uintptr_t low = stack_top - STACK_INITIAL_COMMIT;
+    if (!commit_stack(std::max(low, (uintptr_t)p + STACK_GUARD_SIZE))) {
+        throw std::runtime_error("failed to commit coroutine stack");
+    }
+}
+
+bool Task::commit_stack(uintptr_t low)
+{
+    if (mprotect((void*)low, stack_low - low, PROT_READ | PROT_WRITE)) {
+        return false;
+    }
 
-    regs = (StackFrame*)(stacktop - sizeof(StackFrame));
+    /* fresh pages read as zero, only the paint has to be laid down */
+    if (stack_painted) memset((void*)low, STACK_PAINT, stack_low - low);
 
-    /* setup the return address */
-    reg_t return_address = (reg_t)regs - sizeof(reg_t);
-    /* fix stack alignment(16 bytes at retq) */
-    if (return_address & 0xf) {
-        return_address -= (return_address & 0xf);
+    stack_low = low;
+    return true;
+}
+
+bool Task::grow_stack(uintptr_t addr)
+{
+    uintptr_t bottom = (uintptr_t)stack.get() + STACK_GUARD_SIZE;
+    if (!stack_mapped || addr < bottom || addr >= stack_low) return false;
+
+    /* at least double what is committed so that a deep recursion faults a
+     * logarithmic number of times */
+    uintptr_t low = addr & ~(uintptr_t)(STACK_GUARD_SIZE - 1);
+    size_t committed = stack_top - stack_low;
+    if (stack_low - low < committed) {
+        low = stack_low - std::min(committed, stack_low - bottom);
     }
-    *(reg_t*)return_address = (reg_t)&Task::run;
 
-    /* setup the initial stack pointer */
-    regs->rsp = return_address;
+    size_t grown = stack_low - low;
+    if (!commit_stack(low)) return false;
+
+    auto* thread = ThreadContext::get_current_thread();
+    if (thread) thread->get_counters().shared.stack_committed.add(grown);
 
-    /* setup this pointer(only works for System V amd64 ABI) */
-    regs->rdi = (reg_t)this;
+    return true;
 }
 
 void Task::run(Task* task)
 {
+    /* a new task does not return from switch_to() */
+    auto* thread = ThreadContext::get_current_thread();
+    thread->set_stack_task(task);
+    thread->finish_switch();
+
     try {
         task->func();
     } catch (...) {
         task->eptr = std::current_exception();
     }
 
+    /* measured before the scheduler runs on this stack to pick the next
+     * task, which would count as usage too */
+    if (task->stack_painted) {
+        task->task_class->record_stack_usage(task->get_stack_usage());
+    }
+
     task->state = State::TERMINATED;
     ThreadContext::yield();
 }
 
+void Task::backtrace(std::vector<void*>& frames, size_t max_frames) const
+{
+    reg_t bottom = (reg_t)stack.get();
+    reg_t top = bottom + stacksize + STACK_GUARD_SIZE;
+
+    /* the switch left the return address and the caller's frame pointer in
+     * the saved frame */
+    reg_t sp = this->sp;
+    if (sp < bottom || sp + sizeof(StackFrame) > top) return;
+
+    auto* frame = (const StackFrame*)sp;
+    frames.push_back((void*)frame->rip);
+
+    sp += sizeof(StackFrame);
+    reg_t fp = frame->rbp;
+    while (frames.size() < max_frames) {
+        /* the chain has to move up the stack and stay inside it, anything
+         * compiled without frame pointers ends the walk */
+        if (fp < sp || fp + 2 * sizeof(reg_t) > top || (fp & 7)) break;
+
+        void* pc = ((void**)fp)[1];
+        if (!pc) break;
+        frames.push_back(pc);
+
+        sp = fp;
+        fp = ((reg_t*)fp)[0];
+        if (fp <= sp) break;
+    }
+}
+
+size_t Task::get_stack_usage() const
+{
+    if (!stack_painted) return 0;
+
+    uint64_t paint;
+    memset(&paint, STACK_PAINT, sizeof(paint));
+
+    /* the stack grows down, the lowest word that changed marks the peak */
+    auto* bottom = (const uint64_t*)(stack_mapped ? (uint8_t*)stack_low
+                                                  : stack.get());
+    auto* top = (const uint64_t*)(stack.get() + stacksize + STACK_GUARD_SIZE);
+    auto* p = bottom;
+    while (p < top && *p == paint) {
+        p++;
+    }
+
+    return (top - p) * sizeof(uint64_t);
+}
+
 bool Task::check_stack_overflow()
 {
-    reg_t sp = regs->rsp - (reg_t)stack.get();
+    reg_t sp = this->sp - (reg_t)stack.get();
 
     return !((sp >= STACK_GUARD_SIZE) &&
              (sp <= STACK_GUARD_SIZE + stacksize - sizeof(StackFrame)));
@@ -1,6 +1,18 @@
 #include "coco/thread_context.h"
+#include "coco/coop.h"
+#include "coco/growable_stack.h"
 #include "coco/scheduler.h"
 #include "coco/task.h"
+#include "coco/tsc.h"
+
+#include <cpuid.h>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <ucontext.h>
+
+#include <chrono>
+#include <cstdlib>
 
 namespace coco {
 
@@ -10,9 +22,18 @@ static thread_local ThreadContext* __current_thread = nullptr;
 
 ThreadContext::ThreadContext(Scheduler* parent, Id id)
     : parent(parent), tid(id), stopped(false), waiting(false),
-      idle_task([] {}, 128), eptr(nullptr), io_poller(this)
+      idle_task([] {}, 128), eptr(nullptr), switch_prev(nullptr),
+      io_poller(IOPoller::create(this)),
+      histogram_slot(TaskClass::acquire_worker_slot()), trace_buf(nullptr),
+      slice_start(0), slice_task(0), native_thread_valid(false),
+      preempt_requested(false), preempting(false), stack_task(nullptr)
 {}
 
+ThreadContext::~ThreadContext()
+{
+    TaskClass::release_worker_slot(histogram_slot);
+}
+
 ThreadContext* ThreadContext::get_current_thread()
 {
     return detail::__current_thread;
@@ -33,27 +54,57 @@ IOPoller* ThreadContext::get_current_io_poller()
 void ThreadContext::run()
 {
     detail::__current_thread = this;
+    native_thread = pthread_self();
+    native_thread_valid.store(true, std::memory_order_release);
 
     waiting = false;
     eptr = nullptr;
 
     run_queue_lock.lock();
 
-    if (run_queue.empty()) {
+    /* notify_idle() may wake us before there is anything to run */
+    while (run_queue.empty()) {
         run_queue_lock.unlock();
-        wait();
+        if (!parent->steal_work(this)) wait();
 
-        if (stopped) return;
+        if (stopped) {
+            native_thread_valid.store(false, std::memory_order_release);
+            detail::__current_thread = nullptr;
+            return;
+        }
 
         run_queue_lock.lock();
     }
 
     current_task = std::move(run_queue.front());
-    run_queue.pop();
+    run_queue.pop_front();
     run_queue_lock.unlock();
 
+    /* a growable stack faults with no room left on it for the handler */
+    if (is_growable_stacks_enabled()) {
+        if (!signal_stack) signal_stack.reset(new uint8_t[SIGNAL_STACK_SIZE]);
+
+        stack_t ss = {};
+        ss.ss_sp = signal_stack.get();
+        ss.ss_size = SIGNAL_STACK_SIZE;
+        sigaltstack(&ss, nullptr);
+    }
+
+    current_task->on_cpu.store(true, std::memory_order_relaxed);
+    switch_prev = nullptr;
+    preempt_disable();
+    account_switch(&idle_task, current_task.get());
     switch_to(&idle_task, current_task.get());
+    finish_switch();
+
+    /* the signal stack goes away with this context, the thread does not */
+    if (signal_stack) {
+        stack_t ss = {};
+        ss.ss_flags = SS_DISABLE;
+        sigaltstack(&ss, nullptr);
+    }
 
+    native_thread_valid.store(false, std::memory_order_release);
     detail::__current_thread = nullptr;
 
     if (eptr) {
@@ -61,6 +112,12 @@ void ThreadContext::run()
     }
 }
 
+void ThreadContext::restart()
+{
+    std::lock_guard<std::mutex> lock(cv_mutex);
+    stopped = false;
+}
+
 void ThreadContext::stop()
 {
 
@@ -68,25 +125,69 @@ void ThreadContext::stop()
     stopped = true;
 }
 
+void ThreadContext::drop_tasks()
+{
+    /* the operations still in flight refer to the tasks */
+    io_poller = IOPoller::create(this);
+    timers.clear();
+
+    {
+        std::lock_guard<SpinLock> lock(async_queue.lock);
+        async_queue.ready.clear();
+        async_queue.draining = false;
+    }
+
+    {
+        std::lock_guard<SpinLock> lock(run_queue_lock);
+        current_task.reset();
+        run_queue.clear();
+        waiting_queue.clear();
+        zombie_queue = {};
+    }
+
+    counters.reset();
+}
+
 void ThreadContext::gc()
 {
-    while (!zombie_queue.empty()) {
-        zombie_queue.pop();
+    std::queue<TaskPtr> zombies;
+    {
+        std::lock_guard<SpinLock> lock(run_queue_lock);
+        zombies.swap(zombie_queue);
+    }
+
+    size_t freed = 0, released = 0;
+    while (!zombies.empty()) {
+        auto& task = zombies.front();
+        freed += task->get_stacksize();
+        released += task->get_stack_committed();
+        task->free_stack();
+        zombies.pop();
+    }
+
+    if (freed) {
+        counters.shared.stack_freed.add(freed);
+        counters.shared.stack_released.add(released);
     }
 }
 
-void ThreadContext::queue_task(std::unique_ptr<Task> task)
+void ThreadContext::queue_task(TaskPtr task)
 {
-    run_queue.push(std::move(task));
+    std::lock_guard<SpinLock> lock(run_queue_lock);
+    run_queue.push_back(std::move(task));
 }
 
 void ThreadContext::steal_tasks(size_t n,
-                                std::vector<std::unique_ptr<Task>>& tasks)
+                                std::vector<TaskPtr>& tasks)
 {
     std::lock_guard<SpinLock> lock(run_queue_lock);
     while (!run_queue.empty() && tasks.size() < n) {
+        /* just queued by a yield which has not switched away from it yet */
+        if (run_queue.front()->on_cpu.load(std::memory_order_acquire)) break;
+
         tasks.emplace_back(std::move(run_queue.front()));
-        run_queue.pop();
+        run_queue.pop_front();
+        counters.shared.steals_out.add();
     }
 }
 
@@ -97,32 +198,76 @@ void ThreadContext::notify()
     }
 }
 
-void ThreadContext::poll_io() { io_poller.poll(); }
+void ThreadContext::poll_io() { io_poller->poll(); }
 
 void ThreadContext::wait()
 {
     gc();
 
+    /* sleep no longer than until the next timer is due */
+    auto deadline = timers.next_deadline();
+
     std::unique_lock<std::mutex> lock(cv_mutex);
     if (stopped) return;
     waiting = true;
-    cv.wait(lock);
+    auto start = Clock::now();
+    if (deadline == Clock::time_point::max()) {
+        cv.wait(lock);
+    } else {
+        cv.wait_until(lock, deadline);
+    }
     waiting = false;
+
+    counters.local.idle_ns.add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                             start)
+            .count());
 }
 
-void ThreadContext::yield() { get_current_thread()->yield_current(); }
-void ThreadContext::sleep() { get_current_thread()->sleep_current(true); }
-void ThreadContext::set_sleep() { get_current_thread()->sleep_current(false); }
+void ThreadContext::run_timers()
+{
+    if (!timers.empty()) {
+        timers.run(Clock::now());
+    }
+}
+
+/* preemption is disabled before the thread is looked up so that the task can
+ * not move away from it in between. the switch turns it back on */
+void ThreadContext::yield()
+{
+    preempt_disable();
+    get_current_thread()->yield_current();
+}
+
+void ThreadContext::sleep(ParkReason reason, uint64_t arg)
+{
+    preempt_disable();
+    get_current_thread()->sleep_current(true, reason, arg);
+}
+
+void ThreadContext::set_sleep(ParkReason reason, uint64_t arg)
+{
+    preempt_disable();
+    get_current_thread()->sleep_current(false, reason, arg);
+    preempt_enable();
+}
 
 void ThreadContext::yield_current()
 {
     Task* prev = current_task.get();
     Task* next = nullptr;
 
-    if (current_task->state == Task::State::TERMINATED &&
-        current_task->eptr != nullptr) {
-        eptr = current_task->eptr;
-        stopped = true;
+    if (current_task->state == Task::State::TERMINATED) {
+        /* before the last task stops the run and we switch to idle_task */
+        trace(TraceEvent::TERMINATE, prev);
+
+        if (current_task->eptr != nullptr) {
+            eptr = current_task->eptr;
+            stopped = true;
+        }
+
+        /* may stop every thread, this one included */
+        parent->task_exited();
     }
 
     if (stopped) {
@@ -131,19 +276,30 @@ void ThreadContext::yield_current()
     }
 
     if (!next) {
+        /* a busy thread may never go idle, fire the timers due by now */
+        run_timers();
+
         run_queue_lock.lock();
 
     retry:
         while (run_queue.empty()) {
             if (current_task->state == Task::State::RUNNABLE) {
+                /* resumed right away, still a delay sample */
+                if (!current_task->runnable_tsc) {
+                    current_task->runnable_tsc = rdtsc();
+                }
                 next = current_task.get();
                 break;
             }
 
             run_queue_lock.unlock();
 
-            io_poller.poll();
-            if (!has_runnable()) {
+            /* nothing of ours runs while we poll on behalf of the task */
+            slice_start.store(0, std::memory_order_relaxed);
+
+            io_poller->poll();
+            run_timers();
+            if (!has_runnable() && !parent->steal_work(this)) {
                 wait();
             }
 
@@ -165,7 +321,11 @@ void ThreadContext::yield_current()
              * context */
             switch (current_task->state) {
             case Task::State::RUNNABLE:
-                run_queue.push(std::move(current_task));
+                current_task->runnable_tsc = rdtsc();
+                current_task->park_reason =
+                    preempting ? ParkReason::PREEMPT : ParkReason::YIELD;
+                trace(TraceEvent::PARK, prev, 0, current_task->park_reason);
+                run_queue.push_back(std::move(current_task));
                 break;
             case Task::State::SLEEPING:
                 waiting_queue.push_back(std::move(current_task));
@@ -176,16 +336,30 @@ void ThreadContext::yield_current()
             }
 
             current_task = std::move(run_queue.front());
-            run_queue.pop();
+            run_queue.pop_front();
             next = current_task.get();
         }
 
         run_queue_lock.unlock();
     }
 
+    if (prev != next) counters.local.context_switches.add();
+    account_switch(prev, next);
+    preempting = false;
+
+    next->on_cpu.store(true, std::memory_order_relaxed);
+    switch_prev = (prev != next) ? prev : nullptr;
     prev = switch_to(prev, next);
 
-    if (prev->state != Task::State::TERMINATED) {
+    /* the task may have been stolen while it was away and resumed by another
+     * thread, `this' is stale from here on */
+    auto* thread = get_current_thread();
+    thread->finish_switch();
+
+    /* the idle task runs on the thread's own stack, we get here from it when
+     * run() picks up a task which was stolen from another thread */
+    if (prev != &thread->idle_task &&
+        prev->state != Task::State::TERMINATED) {
         if (__builtin_expect(prev->check_stack_overflow(), false)) {
             /* we are throwing an exception on the next task's stack so it will
              * be catched by Task::run() and cause the next task to enter this
@@ -195,24 +369,206 @@ void ThreadContext::yield_current()
     }
 }
 
-void ThreadContext::sleep_current(bool yield_now)
+void ThreadContext::finish_switch()
+{
+    /* we are on the next task's stack now so the previous one is safe to be
+     * resumed anywhere */
+    if (switch_prev) {
+        switch_prev->on_cpu.store(false, std::memory_order_release);
+        switch_prev = nullptr;
+    }
+
+    /* disabled by whoever switched to us */
+    preempt_enable();
+}
+
+void ThreadContext::account_switch(Task* prev, Task* next)
+{
+    uint64_t now = rdtsc();
+    bool sampled = histogram_slot >= 0 && is_latency_stats_enabled();
+
+    /* a yield with nothing else to run ends the slice as well */
+    if (prev != &idle_task) {
+        if (sampled) {
+            auto& h = prev->task_class->get_histograms(histogram_slot);
+            h.run_time.record(now - prev->slice_tsc);
+        }
+        if (prev != next) trace(TraceEvent::SWITCH_OUT, prev);
+    }
+
+    if (next != &idle_task) {
+        if (next->runnable_tsc) {
+            if (sampled) {
+                auto& h = next->task_class->get_histograms(histogram_slot);
+                h.sched_delay.record(now - next->runnable_tsc);
+            }
+            next->runnable_tsc = 0;
+        }
+        next->slice_tsc = now;
+        if (prev != next) {
+            trace(TraceEvent::SWITCH_IN, next, (uint64_t)next->task_class);
+        }
+
+        slice_task.store(next->id, std::memory_order_relaxed);
+    }
+
+    slice_start.store(next != &idle_task ? now : 0, std::memory_order_relaxed);
+
+    /* a full budget for every slice, see coop.h */
+    detail::coop_left = next != &idle_task ? get_coop_budget() : 0;
+}
+
+int ThreadContext::preempt_signo = 0;
+
+/* text of the executable, code in shared libraries (libc in particular) is
+ * never interrupted */
+static reg_t exe_text_start;
+static reg_t exe_text_end;
+
+/* left below the interrupted stack pointer for coco_async_preempt() and the
+ * yield it makes */
+static const size_t PREEMPT_STACK_ROOM = 16 * 1024;
+
+static int find_exe_text(struct dl_phdr_info* info, size_t, void*)
+{
+    /* the executable comes first */
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        auto* phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) {
+            exe_text_start = info->dlpi_addr + phdr->p_vaddr;
+            exe_text_end = exe_text_start + phdr->p_memsz;
+            break;
+        }
+    }
+
+    return 1;
+}
+
+bool ThreadContext::enable_preemption(int signo)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    /* the interrupted code may have any extended state live */
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+        return false;
+    }
+    __cpuid_count(0xd, 0, eax, ebx, ecx, edx);
+    coco_xsave_size = ebx + 64;
+
+    dl_iterate_phdr(find_exe_text, nullptr);
+    if (exe_text_start == exe_text_end) return false;
+
+    struct sigaction sa = {};
+    sa.sa_sigaction = &ThreadContext::handle_preempt_signal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(signo, &sa, nullptr)) return false;
+
+    preempt_signo = signo;
+
+    return true;
+}
+
+void ThreadContext::request_preempt()
+{
+    if (!preempt_signo ||
+        !native_thread_valid.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    preempt_requested.store(true, std::memory_order_relaxed);
+    pthread_kill(native_thread, preempt_signo);
+}
+
+void ThreadContext::handle_preempt_signal(int, siginfo_t*, void* ctx)
+{
+    auto* thread = get_current_thread();
+
+    /* the signal may come from elsewhere, e.g. SIGURG for out-of-band data */
+    if (!thread ||
+        !thread->preempt_requested.exchange(false, std::memory_order_relaxed)) {
+        return;
+    }
+
+    /* the monitor asks again on its next tick if we are not at a safe point
+     * now */
+    if (detail::preempt_off) return;
+
+    Task* task = thread->current_task.get();
+    if (!task || task->state != Task::State::RUNNABLE) return;
+
+    auto* mctx = &((ucontext_t*)ctx)->uc_mcontext;
+    reg_t pc = mctx->gregs[REG_RIP];
+    reg_t sp = mctx->gregs[REG_RSP];
+
+    if (pc < exe_text_start || pc >= exe_text_end) return;
+
+    reg_t bottom = (reg_t)task->stack.get() + Task::STACK_GUARD_SIZE;
+    if (sp > bottom + task->stacksize ||
+        sp < bottom + coco_xsave_size + PREEMPT_STACK_ROOM) {
+        return;
+    }
+
+    /* make the task call coco_async_preempt() from where it was interrupted,
+     * without touching its red zone */
+    sp -= 128 + sizeof(reg_t);
+    *(reg_t*)sp = pc;
+    mctx->gregs[REG_RSP] = sp;
+    mctx->gregs[REG_RIP] = (reg_t)&coco_async_preempt;
+}
+
+void ThreadContext::preempt()
+{
+    preempt_disable();
+
+    auto* thread = get_current_thread();
+    thread->counters.local.preemptions.add();
+    thread->preempting = true;
+    thread->yield_current();
+}
+
+void ThreadContext::trace_event(TraceEvent type, Task* task, uint64_t arg,
+                                ParkReason reason)
+{
+    auto* buf = trace_buf.load(std::memory_order_acquire);
+    if (!buf) {
+        buf = Tracer::get_instance().get_buffer(tid);
+        trace_buf.store(buf, std::memory_order_release);
+    }
+
+    buf->append(type, task ? task->id : 0, arg, reason);
+}
+
+void ThreadContext::sleep_current(bool yield_now, ParkReason reason,
+                                  uint64_t arg)
 {
     current_task->state = Task::State::SLEEPING;
+    current_task->park_reason = reason;
+    current_task->park_arg = arg;
+    counters.local.parks.add();
+    trace(TraceEvent::PARK, current_task.get(), arg, reason);
     if (yield_now) yield_current();
 }
 
 void ThreadContext::wake_up(Task* task)
 {
+    auto* waker = get_current_thread();
+    bool local = this == waker;
+
+    trace(TraceEvent::WAKE, task, waker ? waker->tid : NO_THREAD_ID);
+
     {
         std::lock_guard<SpinLock> lock(run_queue_lock);
         if (task == current_task.get()) {
             current_task->state = Task::State::RUNNABLE;
+            current_task->runnable_tsc = rdtsc();
         } else {
             for (auto it = waiting_queue.begin(); it != waiting_queue.end();
                  it++) {
                 if (it->get() == task) {
                     (*it)->state = Task::State::RUNNABLE;
-                    run_queue.push(std::move(*it));
+                    (*it)->runnable_tsc = rdtsc();
+                    run_queue.push_back(std::move(*it));
                     waiting_queue.erase(it);
                     break;
                 }
@@ -220,37 +576,162 @@ void ThreadContext::wake_up(Task* task)
         }
     }
 
-    if (this != get_current_thread()) {
+    if (local) {
+        counters.local.local_wakes.add();
+    } else {
+        counters.shared.remote_wakes.add();
         notify();
     }
 }
 
-Task* ThreadContext::switch_to(Task* prev, Task* next)
-{
-    __asm__ volatile("mov %0, %%rax\n\t"
-                     "mov %%rsp, (%1)\n\t" // save prev stack pointer
-                     "mov %1, %%rsp\n\t"
-                     "push %%rbx\n\t" // save prev registers
-                     "push %%rbp\n\t"
-                     "push %%r12\n\t"
-                     "push %%r13\n\t"
-                     "push %%r14\n\t"
-                     "push %%r15\n\t"
-                     "push %%rdi\n\t"
-                     "mov %2, %%rsp\n\t"
-                     "pop %%rdi\n\t" // restore next registers
-                     "pop %%r15\n\t"
-                     "pop %%r14\n\t"
-                     "pop %%r13\n\t"
-                     "pop %%r12\n\t"
-                     "pop %%rbp\n\t"
-                     "pop %%rbx\n\t"
-                     "pop %%rsp\n\t"
-                     "retq" ::"r"(prev),
-                     "r"((uint8_t*)prev->regs + sizeof(StackFrame) -
-                         sizeof(reg_t)), // rsp in prev stack frame
-                     "r"(next->regs)
-                     : "rax", "rdi", "memory");
+WorkerStats ThreadContext::get_stats()
+{
+    WorkerStats stats;
+
+    stats.tid = tid;
+    counters.fill(stats);
+
+    std::lock_guard<SpinLock> lock(run_queue_lock);
+    stats.runnable_tasks = run_queue.size();
+    stats.sleeping_tasks = waiting_queue.size();
+    stats.zombie_tasks = zombie_queue.size();
+
+    /* the current task stays out of the queues while the worker idles */
+    if (current_task) {
+        switch (current_task->state) {
+        case Task::State::RUNNABLE:
+            stats.runnable_tasks++;
+            break;
+        case Task::State::SLEEPING:
+            stats.sleeping_tasks++;
+            break;
+        case Task::State::TERMINATED:
+            stats.zombie_tasks++;
+            break;
+        }
+    }
+
+    return stats;
+}
+
+static const char* get_state_name(Task::State state)
+{
+    switch (state) {
+    case Task::State::RUNNABLE:
+        return "runnable";
+    case Task::State::SLEEPING:
+        return "sleeping";
+    default:
+        return "terminated";
+    }
+}
+
+static void print_frame(std::ostream& os, size_t index, void* pc)
+{
+    os << "    #" << index << " " << pc;
+
+    /* return addresses point after the call, look up the call itself */
+    Dl_info info;
+    if (!dladdr((char*)pc - 1, &info)) {
+        os << "\n";
+        return;
+    }
+
+    if (info.dli_sname) {
+        int status;
+        char* name = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr,
+                                         &status);
+        os << " " << (status == 0 ? name : info.dli_sname) << "+0x" << std::hex
+           << (uintptr_t)pc - (uintptr_t)info.dli_saddr << std::dec;
+        free(name);
+    } else if (info.dli_fbase) {
+        os << " +0x" << std::hex << (uintptr_t)pc - (uintptr_t)info.dli_fbase
+           << std::dec;
+    }
+
+    if (info.dli_fname) os << " (" << info.dli_fname << ")";
+    os << "\n";
+}
+
+/* what is printed about a task, copied while the run queue is locked */
+struct TaskDump {
+    uint64_t id;
+    const TaskClass* task_class; /* never freed */
+    Task::State state;
+    ParkReason reason;
+    uint64_t arg;
+    bool running;
+    std::vector<void*> frames;
+};
+
+static void dump_task(std::ostream& os, const TaskDump& dump)
+{
+    os << "  task " << dump.id << " [" << dump.task_class->get_label() << "] "
+       << (dump.running ? "running" : get_state_name(dump.state));
+
+    if (dump.state != Task::State::TERMINATED &&
+        dump.reason != ParkReason::OTHER) {
+        os << " (" << get_park_reason_name(dump.reason);
+        if (dump.reason == ParkReason::IO) {
+            os << " fd " << (int)dump.arg;
+        } else if (dump.reason == ParkReason::FUTEX) {
+            os << " " << (void*)dump.arg;
+        }
+        os << ")";
+    }
+    os << "\n";
+
+    for (size_t i = 0; i < dump.frames.size(); i++) {
+        print_frame(os, i, dump.frames[i]);
+    }
+}
+
+void ThreadContext::dump_tasks(std::ostream& os)
+{
+    std::vector<TaskDump> dumps;
+    size_t nr_runnable, nr_sleeping;
+    bool idle;
+
+    auto snapshot = [&dumps](const Task* task, bool running) {
+        dumps.push_back({task->get_id(), task->get_class(),
+                         task->state, task->park_reason, task->park_arg,
+                         running, {}});
+        if (!running && task->state != Task::State::TERMINATED) {
+            task->backtrace(dumps.back().frames);
+        }
+    };
+
+    /* tasks can not be resumed or stolen while the run queue is locked, the
+     * stacks of the queued ones are stable until their frames are copied.
+     * the symbols are looked up and printed once it is unlocked */
+    {
+        std::lock_guard<SpinLock> lock(run_queue_lock);
+
+        nr_runnable = run_queue.size();
+        nr_sleeping = waiting_queue.size();
+        idle = waiting;
+
+        /* the current task is on the cpu even when the thread idles in
+         * yield_current() on its behalf */
+        if (current_task) snapshot(current_task.get(), true);
+
+        for (auto&& task : run_queue) {
+            snapshot(task.get(), task->on_cpu.load(std::memory_order_acquire));
+        }
+
+        for (auto&& task : waiting_queue) {
+            snapshot(task.get(), task->on_cpu.load(std::memory_order_acquire));
+        }
+    }
+
+    os << "thread " << tid << ": " << nr_runnable << " runnable, "
+       << nr_sleeping << " sleeping" << (idle ? ", idle" : "") << "\n";
+
+    for (auto&& dump : dumps) {
+        dump_task(os, dump);
+    }
 }
 
 } // namespace coco
+
+extern "C" void coco_preempt() { coco::ThreadContext::preempt(); }
@@ -0,0 +1,122 @@
+#include "coco/timer.h"
+#include "coco/thread_context.h"
+
+#include <mutex>
+
+namespace coco {
+
+void TimerQueue::add(Timer* timer)
+{
+    std::lock_guard<SpinLock> guard(lock);
+
+    timer->fired = false;
+    timer->index = heap.size();
+    heap.push_back(timer);
+    sift_up(timer->index);
+
+    size.store(heap.size(), std::memory_order_relaxed);
+}
+
+bool TimerQueue::remove(Timer* timer)
+{
+    std::lock_guard<SpinLock> guard(lock);
+
+    if (timer->index == Timer::NOT_QUEUED) {
+        return false;
+    }
+
+    remove_at(timer->index);
+    size.store(heap.size(), std::memory_order_relaxed);
+
+    return true;
+}
+
+Clock::time_point TimerQueue::next_deadline()
+{
+    std::lock_guard<SpinLock> guard(lock);
+
+    if (heap.empty()) return Clock::time_point::max();
+    return heap.front()->deadline;
+}
+
+void TimerQueue::run(Clock::time_point now)
+{
+    std::lock_guard<SpinLock> guard(lock);
+
+    while (!heap.empty() && heap.front()->deadline <= now) {
+        auto* timer = heap.front();
+        remove_at(0);
+
+        /* woken up under the lock so that a sleeper which removes its timer
+         * after being woken up by something else never sees a late wake up */
+        timer->fired = true;
+        timer->thread->wake_up(timer->task);
+    }
+
+    size.store(heap.size(), std::memory_order_relaxed);
+}
+
+void TimerQueue::clear()
+{
+    std::lock_guard<SpinLock> guard(lock);
+
+    heap.clear();
+    size.store(0, std::memory_order_relaxed);
+}
+
+void TimerQueue::swap_entries(size_t i, size_t j)
+{
+    std::swap(heap[i], heap[j]);
+    heap[i]->index = i;
+    heap[j]->index = j;
+}
+
+void TimerQueue::sift_up(size_t i)
+{
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (heap[parent]->deadline <= heap[i]->deadline) break;
+
+        swap_entries(i, parent);
+        i = parent;
+    }
+}
+
+void TimerQueue::sift_down(size_t i)
+{
+    while (true) {
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        size_t min = i;
+
+        if (left < heap.size() && heap[left]->deadline < heap[min]->deadline)
+            min = left;
+        if (right < heap.size() && heap[right]->deadline < heap[min]->deadline)
+            min = right;
+
+        if (min == i) break;
+
+        swap_entries(i, min);
+        i = min;
+    }
+}
+
+void TimerQueue::remove_at(size_t i)
+{
+    heap[i]->index = Timer::NOT_QUEUED;
+
+    size_t last = heap.size() - 1;
+    if (i != last) {
+        auto* moved = heap[last];
+        heap[i] = moved;
+        moved->index = i;
+        heap.pop_back();
+
+        sift_up(i);
+        sift_down(moved->index);
+    } else {
+        heap.pop_back();
+    }
+}
+
+} // namespace coco
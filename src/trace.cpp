@@ -0,0 +1,272 @@
+#include "coco/trace.h"
+#include "coco/histogram.h"
+#include "coco/tsc.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace coco {
+
+std::atomic<bool> Tracer::enabled{false};
+
+static size_t round_up_pow2(size_t n)
+{
+    size_t size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+TraceBuffer::TraceBuffer(size_t tid, size_t size)
+    : tid(tid), mask(round_up_pow2(size ? size : 1) - 1),
+      slots(new Slot[mask + 1]), head(0)
+{
+    for (size_t i = 0; i <= mask; i++) {
+        slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+void TraceBuffer::append(TraceEvent type, uint64_t task, uint64_t arg,
+                         ParkReason reason)
+{
+    uint64_t index = head.fetch_add(1, std::memory_order_relaxed);
+    auto& slot = slots[index & mask];
+
+    /* odd while being written */
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.tsc.store(rdtsc(), std::memory_order_relaxed);
+    slot.task.store(task, std::memory_order_relaxed);
+    slot.arg.store(arg, std::memory_order_relaxed);
+    slot.info.store((uint32_t)type | (uint32_t)reason << 8,
+                    std::memory_order_relaxed);
+
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+}
+
+void TraceBuffer::read(std::vector<Record>& records) const
+{
+    uint64_t end = head.load(std::memory_order_acquire);
+    uint64_t start = end > mask + 1 ? end - mask - 1 : 0;
+
+    for (uint64_t index = start; index < end; index++) {
+        auto& slot = slots[index & mask];
+
+        uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * index + 2) continue;
+
+        Record record;
+        record.tsc = slot.tsc.load(std::memory_order_relaxed);
+        record.task = slot.task.load(std::memory_order_relaxed);
+        record.arg = slot.arg.load(std::memory_order_relaxed);
+        uint32_t info = slot.info.load(std::memory_order_relaxed);
+        record.type = (TraceEvent)(info & 0xff);
+        record.reason = (ParkReason)(info >> 8);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+
+        records.push_back(record);
+    }
+}
+
+void TraceBuffer::clear()
+{
+    head.store(0, std::memory_order_relaxed);
+    for (size_t i = 0; i <= mask; i++) {
+        slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+Tracer& Tracer::get_instance()
+{
+    static Tracer tracer;
+    return tracer;
+}
+
+void Tracer::start(size_t events_per_thread)
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+
+    this->events_per_thread = events_per_thread;
+    for (auto&& p : buffers) {
+        p.second->clear();
+    }
+
+    enabled.store(true, std::memory_order_release);
+}
+
+void Tracer::stop() { enabled.store(false, std::memory_order_release); }
+
+TraceBuffer* Tracer::get_buffer(size_t tid)
+{
+    std::lock_guard<PreemptMutex> lock(mutex);
+
+    auto& p = buffers[tid];
+    if (!p) p = std::make_unique<TraceBuffer>(tid, events_per_thread);
+
+    return p.get();
+}
+
+const char* get_park_reason_name(ParkReason reason)
+{
+    switch (reason) {
+    case ParkReason::YIELD:
+        return "yield";
+    case ParkReason::IO:
+        return "io";
+    case ParkReason::FUTEX:
+        return "futex";
+    case ParkReason::BLOCKING:
+        return "blocking";
+    case ParkReason::PREEMPT:
+        return "preempt";
+    default:
+        return "other";
+    }
+}
+
+static void write_string(std::ostream& os, const std::string& str)
+{
+    os << '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            os << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            os << ' ';
+        } else {
+            os << c;
+        }
+    }
+    os << '"';
+}
+
+static void write_event(std::ostream& os, size_t tid, double ts,
+                        const TraceBuffer::Record& record)
+{
+    const std::string* label = nullptr;
+    const char* name = nullptr;
+    const char* phase = "i";
+
+    switch (record.type) {
+    case TraceEvent::SPAWN:
+        name = "spawn";
+        break;
+    case TraceEvent::SWITCH_IN:
+        label = &((TaskClass*)record.arg)->get_label();
+        phase = "B";
+        break;
+    case TraceEvent::SWITCH_OUT:
+        phase = "E";
+        break;
+    case TraceEvent::PARK:
+        name = "park";
+        break;
+    case TraceEvent::WAKE:
+        name = "wake";
+        break;
+    case TraceEvent::STEAL:
+        name = "steal";
+        break;
+    case TraceEvent::TERMINATE:
+        name = "terminate";
+        break;
+    }
+
+    os << "{\"ph\":\"" << phase << "\",\"pid\":1,\"tid\":" << tid
+       << ",\"ts\":" << ts;
+    if (label) {
+        os << ",\"name\":";
+        write_string(os, *label);
+    } else if (name) {
+        os << ",\"name\":\"" << name << "\"";
+    }
+    if (*phase == 'i') os << ",\"s\":\"t\"";
+
+    os << ",\"args\":{\"task\":" << record.task;
+    switch (record.type) {
+    case TraceEvent::SPAWN:
+        os << ",\"parent\":" << record.arg;
+        break;
+    case TraceEvent::PARK:
+        os << ",\"reason\":\"" << get_park_reason_name(record.reason)
+           << "\",\"arg\":" << (int64_t)record.arg;
+        break;
+    case TraceEvent::WAKE:
+        os << ",\"source\":" << record.arg;
+        break;
+    case TraceEvent::STEAL:
+        os << ",\"from\":" << record.arg;
+        break;
+    default:
+        break;
+    }
+    os << "}}";
+}
+
+void Tracer::write_json(std::ostream& os)
+{
+    struct Event {
+        size_t tid;
+        TraceBuffer::Record record;
+    };
+
+    std::vector<Event> events;
+    {
+        std::lock_guard<PreemptMutex> lock(mutex);
+
+        std::vector<TraceBuffer::Record> records;
+        for (auto&& p : buffers) {
+            records.clear();
+            p.second->read(records);
+            for (auto&& record : records) {
+                events.push_back({p.first, record});
+            }
+        }
+    }
+
+    std::stable_sort(events.begin(), events.end(),
+                     [](const Event& a, const Event& b) {
+                         return a.record.tsc < b.record.tsc;
+                     });
+
+    uint64_t base = events.empty() ? 0 : events.front().record.tsc;
+
+    os << "{\"traceEvents\":[";
+
+    bool first = true;
+    {
+        std::lock_guard<PreemptMutex> lock(mutex);
+        for (auto&& p : buffers) {
+            if (!first) os << ",";
+            first = false;
+            os << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << p.first
+               << ",\"name\":\"thread_name\",\"args\":{\"name\":\"worker "
+               << p.first << "\"}}";
+        }
+    }
+
+    for (auto&& event : events) {
+        if (!first) os << ",";
+        first = false;
+        write_event(os, event.tid,
+                    tsc_to_ns(event.record.tsc - base) / 1000.0,
+                    event.record);
+    }
+
+    os << "],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+bool Tracer::write_json(const char* path)
+{
+    std::ofstream os(path);
+    if (!os) return false;
+
+    write_json(os);
+
+    return os.good();
+}
+
+} // namespace coco
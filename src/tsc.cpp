@@ -0,0 +1,38 @@
+#include "coco/tsc.h"
+
+#include <chrono>
+
+namespace coco {
+
+namespace detail {
+
+struct TscOrigin {
+    std::chrono::steady_clock::time_point time;
+    uint64_t tsc;
+
+    TscOrigin() : time(std::chrono::steady_clock::now()), tsc(rdtsc()) {}
+};
+
+static TscOrigin tsc_origin;
+
+} // namespace detail
+
+static double get_ns_per_cycle()
+{
+    auto& origin = detail::tsc_origin;
+
+    uint64_t tsc = rdtsc();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - origin.time)
+                  .count();
+
+    if (tsc <= origin.tsc || ns <= 0) return 1.0;
+
+    return (double)ns / (tsc - origin.tsc);
+}
+
+double tsc_to_ns(uint64_t cycles) { return cycles * get_ns_per_cycle(); }
+
+uint64_t ns_to_tsc(uint64_t ns) { return ns / get_ns_per_cycle(); }
+
+} // namespace coco
@@ -0,0 +1,460 @@
+#include "coco/uring_poller.h"
+#include "coco/preempt.h"
+#include "coco/thread_context.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace coco {
+
+#define MAX_RINGS 64
+
+/* rings which have a registered file table, indexed by ring id. used to drop
+ * the registered files of an fd when it is closed */
+static PreemptMutex ring_registry_mutex;
+static UringPoller* ring_registry[MAX_RINGS];
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                          unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   nullptr, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg,
+                             unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+UringPoller::UringPoller(ThreadContext* parent)
+    : EpollPoller(parent), ring_fd(-1), ring_id(-1), ring_ptr(MAP_FAILED),
+      ring_size(0), sqes((struct io_uring_sqe*)MAP_FAILED), sqes_size(0),
+      sq_pending(0), nr_fixed_files(0)
+{}
+
+UringPoller::~UringPoller()
+{
+    if (ring_id != -1) {
+        std::lock_guard<PreemptMutex> lock(ring_registry_mutex);
+        ring_registry[ring_id] = nullptr;
+    }
+
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+    if (ring_ptr != MAP_FAILED) munmap(ring_ptr, ring_size);
+    if (ring_fd != -1) ::close(ring_fd);
+}
+
+std::unique_ptr<UringPoller> UringPoller::create(ThreadContext* parent)
+{
+    std::unique_ptr<UringPoller> poller(new UringPoller(parent));
+
+    if (!poller->setup()) {
+        return nullptr;
+    }
+
+    return poller;
+}
+
+bool UringPoller::setup()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring_fd = io_uring_setup(QUEUE_DEPTH, &params);
+    if (ring_fd == -1) {
+        return false;
+    }
+
+    /* reads and writes use the current file position so we need at least
+     * 5.6 */
+    unsigned required_features =
+        IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_RW_CUR_POS;
+    if ((params.features & required_features) != required_features) {
+        return false;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring_size = std::max(sq_size, cq_size);
+
+    ring_ptr = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (ring_ptr == MAP_FAILED) {
+        return false;
+    }
+
+    sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = (struct io_uring_sqe*)mmap(nullptr, sqes_size,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_POPULATE, ring_fd,
+                                      IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+
+    auto* ring = (uint8_t*)ring_ptr;
+    sq_head = (unsigned*)(ring + params.sq_off.head);
+    sq_tail = (unsigned*)(ring + params.sq_off.tail);
+    sq_mask = (unsigned*)(ring + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(ring + params.sq_off.array);
+    sq_entries = params.sq_entries;
+
+    cq_head = (unsigned*)(ring + params.cq_off.head);
+    cq_tail = (unsigned*)(ring + params.cq_off.tail);
+    cq_mask = (unsigned*)(ring + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+
+    /* fds are registered lazily at the slot of their own number so we need a
+     * sparse file table and a ring id to find us again when they are closed */
+    {
+        std::lock_guard<PreemptMutex> lock(ring_registry_mutex);
+        for (int i = 0; i < MAX_RINGS; i++) {
+            if (!ring_registry[i]) {
+                ring_id = i;
+                break;
+            }
+        }
+
+        if (ring_id != -1) {
+            std::vector<int> files(MAX_FIXED_FILES, -1);
+            if (io_uring_register(ring_fd, IORING_REGISTER_FILES, files.data(),
+                                  files.size()) == 0) {
+                nr_fixed_files = MAX_FIXED_FILES;
+                ring_registry[ring_id] = this;
+            } else {
+                ring_id = -1;
+            }
+        }
+    }
+
+    return true;
+}
+
+void UringPoller::release_fd(PollableFileDesc* pfd)
+{
+    uint64_t rings = pfd->get_fixed_file_rings().exchange(0);
+    if (!rings) return;
+
+    std::lock_guard<PreemptMutex> lock(ring_registry_mutex);
+    for (int i = 0; i < MAX_RINGS; i++) {
+        if ((rings & (1ULL << i)) && ring_registry[i]) {
+            ring_registry[i]->unregister_file(pfd->get_fd());
+        }
+    }
+}
+
+int UringPoller::get_fixed_file(PollableFileDesc* pfd)
+{
+    int fd = pfd->get_fd();
+    if (ring_id == -1 || fd >= (int)nr_fixed_files) {
+        return -1;
+    }
+
+    uint64_t ring_bit = 1ULL << ring_id;
+    auto& rings = pfd->get_fixed_file_rings();
+    if (rings.load(std::memory_order_acquire) & ring_bit) {
+        return fd;
+    }
+
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = fd;
+    update.fds = (uint64_t)&fd;
+
+    if (io_uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1) !=
+        1) {
+        return -1;
+    }
+
+    rings.fetch_or(ring_bit, std::memory_order_release);
+
+    /* the fd may have been closed (and even reused) while we were
+     * registering it. the request holds a reference to pfd so the address
+     * cannot have been recycled */
+    if (IOContext::get_instance().get_pfd(fd) != pfd) {
+        unregister_file(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void UringPoller::unregister_file(int fd)
+{
+    int empty = -1;
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = fd;
+    update.fds = (uint64_t)&empty;
+
+    io_uring_register(ring_fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+}
+
+bool UringPoller::register_buffers(const struct iovec* iov, unsigned nr)
+{
+    std::lock_guard<SpinLock> lock(ring_lock);
+
+    if (!buffers.empty()) {
+        io_uring_register(ring_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        buffers.clear();
+    }
+
+    if (!nr) return true;
+
+    if (io_uring_register(ring_fd, IORING_REGISTER_BUFFERS, iov, nr)) {
+        return false;
+    }
+
+    buffers.assign(iov, iov + nr);
+    return true;
+}
+
+int UringPoller::find_buffer(const void* addr, size_t len) const
+{
+    auto start = (uintptr_t)addr;
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        auto base = (uintptr_t)buffers[i].iov_base;
+        if (start >= base && start + len <= base + buffers[i].iov_len) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+unsigned UringPoller::sq_space() const
+{
+    return sq_entries -
+           (*sq_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE));
+}
+
+void UringPoller::prep_request(struct io_uring_sqe* sqe, IORequest* req)
+{
+    memset(sqe, 0, sizeof(*sqe));
+
+    int fixed_file = get_fixed_file(req->pfd);
+    if (fixed_file != -1) {
+        sqe->fd = fixed_file;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    } else {
+        sqe->fd = req->pfd->get_fd();
+    }
+
+    sqe->addr = (uint64_t)req->addr;
+    sqe->user_data = (uint64_t)req;
+
+    switch (req->op) {
+    case IORequest::Op::READ:
+    case IORequest::Op::WRITE: {
+        bool is_read = req->op == IORequest::Op::READ;
+        int buf_index = find_buffer(req->addr, req->len);
+
+        if (buf_index != -1) {
+            sqe->opcode = is_read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->buf_index = buf_index;
+        } else {
+            sqe->opcode = is_read ? IORING_OP_READ : IORING_OP_WRITE;
+        }
+
+        sqe->len = req->len;
+        sqe->off = (uint64_t)-1; /* use the current file position */
+        break;
+    }
+    case IORequest::Op::READV:
+    case IORequest::Op::WRITEV:
+        sqe->opcode = (req->op == IORequest::Op::READV) ? IORING_OP_READV
+                                                        : IORING_OP_WRITEV;
+        sqe->len = req->len;
+        sqe->off = (uint64_t)-1;
+        break;
+    case IORequest::Op::RECV:
+    case IORequest::Op::SEND:
+        sqe->opcode = (req->op == IORequest::Op::RECV) ? IORING_OP_RECV
+                                                       : IORING_OP_SEND;
+        sqe->len = req->len;
+        sqe->msg_flags = req->flags;
+        break;
+    case IORequest::Op::RECVMSG:
+    case IORequest::Op::SENDMSG:
+        sqe->opcode = (req->op == IORequest::Op::RECVMSG) ? IORING_OP_RECVMSG
+                                                          : IORING_OP_SENDMSG;
+        sqe->len = 1;
+        sqe->msg_flags = req->flags;
+        break;
+    case IORequest::Op::ACCEPT:
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->addr2 = req->addr2;
+        sqe->accept_flags = req->flags;
+        break;
+    }
+}
+
+bool UringPoller::submit(Task* task, IORequest* req)
+{
+    req->thread = parent;
+    req->task = task;
+
+    if (!req->pfd->link_request(req)) {
+        return false;
+    }
+
+    if (!queue_request(req)) {
+        req->pfd->unlink_request(req);
+        return false;
+    }
+
+    /* close() can not cancel a request which was not queued yet */
+    if (req->pfd->is_closed()) {
+        cancel(req);
+    }
+
+    return true;
+}
+
+bool UringPoller::queue_request(IORequest* req)
+{
+    std::lock_guard<SpinLock> lock(ring_lock);
+
+    unsigned nr_sqes = (req->timeout >= 0) ? 2 : 1;
+    if (sq_space() < nr_sqes) {
+        flush();
+        if (sq_space() < nr_sqes) return false;
+    }
+
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    auto* sqe = &sqes[index];
+    prep_request(sqe, req);
+    sq_array[index] = index;
+    tail++;
+
+    if (req->timeout >= 0) {
+        /* the timeout cancels the operation if it fires first, its own
+         * completion is ignored */
+        auto* ts = (struct __kernel_timespec*)req->scratch;
+        ts->tv_sec = req->timeout / 1000;
+        ts->tv_nsec = (req->timeout % 1000) * 1000000LL;
+
+        sqe->flags |= IOSQE_IO_LINK;
+
+        index = tail & *sq_mask;
+        sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_LINK_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t)ts;
+        sqe->len = 1;
+        sq_array[index] = index;
+        tail++;
+    }
+
+    /* submitted in a batch with other tasks' requests on the next poll */
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    sq_pending += nr_sqes;
+
+    return true;
+}
+
+void UringPoller::cancel(IORequest* req)
+{
+    std::lock_guard<SpinLock> lock(ring_lock);
+
+    if (!sq_space()) {
+        flush();
+        if (!sq_space()) return;
+    }
+
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    auto* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)req;
+    sq_array[index] = index;
+
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    sq_pending++;
+
+    /* the owner of the ring may be idle so do not wait for its next poll */
+    flush();
+}
+
+void UringPoller::flush()
+{
+    while (sq_pending) {
+        int retval = io_uring_enter(ring_fd, sq_pending, 0, 0);
+
+        if (retval > 0) {
+            sq_pending -= retval;
+        } else if (retval == -1 && errno == EINTR) {
+            continue;
+        } else {
+            /* completion queue is backed up, retry after the next reap */
+            break;
+        }
+    }
+}
+
+size_t UringPoller::reap(IORequest** completed, size_t max)
+{
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+
+    while (head != tail && n < max) {
+        auto* cqe = &cqes[head & *cq_mask];
+
+        if (cqe->user_data) {
+            auto* req = (IORequest*)cqe->user_data;
+            req->result = cqe->res;
+            completed[n++] = req;
+        }
+
+        head++;
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+void UringPoller::poll()
+{
+    IORequest* completed[MAX_COMPLETIONS];
+    size_t n;
+
+    do {
+        {
+            std::lock_guard<SpinLock> lock(ring_lock);
+            flush();
+            n = reap(completed, MAX_COMPLETIONS);
+        }
+
+        /* requests are woken up outside of the ring lock because the fd lock
+         * is taken before the ring lock when an fd is closed */
+        for (size_t i = 0; i < n; i++) {
+            auto* req = completed[i];
+            req->pfd->unlink_request(req);
+            req->thread->wake_up(req->task);
+        }
+
+        if (n) parent->get_counters().shared.io_events.add(n);
+    } while (n == MAX_COMPLETIONS);
+
+    EpollPoller::poll();
+}
+
+} // namespace coco
@@ -1,5 +1,21 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
 #include <fcntl.h>
+#include <fstream>
 #include <gtest/gtest.h>
+#include <netdb.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <poll.h>
+#include <set>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/select.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 
 #include "coco/coco.h"
@@ -84,6 +100,1240 @@ TEST(CocoTest, HandleIO)
     ASSERT_EQ(result, "test");
 }
 
+TEST(CocoTest, NonBlockingIO)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    /* the fds are non-blocking under the hood but should not look like it */
+    ASSERT_EQ(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+
+    ASSERT_EQ(fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK), 0);
+    ASSERT_NE(fcntl(fds[0], F_GETFL) & O_NONBLOCK, 0);
+
+    ssize_t n = 0;
+    int err = 0;
+    coco::go([fds, &n, &err] {
+        char buf[4];
+        n = read(fds[0], buf, sizeof(buf));
+        err = errno;
+    });
+
+    coco::run();
+
+    ASSERT_EQ(n, -1);
+    ASSERT_EQ(err, EAGAIN);
+
+    ASSERT_EQ(fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) & ~O_NONBLOCK), 0);
+
+    std::string result;
+    uint64_t parks = 1;
+    coco::go([fds, &result, &parks] {
+        auto& sched = coco::Scheduler::get_instance();
+        auto before = sched.stats().total.parks;
+
+        char buf[] = "ab";
+        write(fds[1], buf, 2);
+
+        /* data is already there so this should not park */
+        char rbuf[3] = {0};
+        read(fds[0], rbuf, 2);
+        result = rbuf;
+
+        parks = sched.stats().total.parks - before;
+    });
+
+    coco::run();
+
+    ASSERT_EQ(result, "ab");
+    ASSERT_EQ(parks, 0u);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(CocoTest, StreamingIO)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    size_t total = 0;
+    coco::go([fds, &total] {
+        char buf[16];
+        while (total < 100) {
+            ssize_t n = read(fds[0], buf, sizeof(buf));
+            if (n <= 0) break;
+            total += n;
+        }
+    });
+
+    coco::go([fds] {
+        for (int i = 0; i < 100; i++) {
+            char c = 'a';
+            write(fds[1], &c, 1);
+            if (i % 10 == 0) usleep(1000);
+            coco::yield();
+        }
+    });
+
+    coco::run();
+
+    ASSERT_EQ(total, 100);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(CocoTest, CloseWakesWaiter)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    ssize_t n = 0;
+    int err = 0;
+    coco::go([fds, &n, &err] {
+        char buf[4];
+        n = read(fds[0], buf, sizeof(buf));
+        err = errno;
+    });
+
+    coco::go([fds] {
+        usleep(20000);
+        close(fds[0]);
+    });
+
+    coco::run();
+
+    ASSERT_EQ(n, -1);
+    ASSERT_EQ(err, EBADF);
+
+    close(fds[1]);
+}
+
+TEST(CocoTest, PollTimeout)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    int timed_out = -1, ready = -1, err = 0;
+    std::chrono::milliseconds elapsed;
+
+    coco::go([fds, &timed_out, &ready, &elapsed, &err] {
+        struct pollfd pfd = {fds[0], POLLIN, 0};
+
+        auto start = std::chrono::steady_clock::now();
+        timed_out = poll(&pfd, 1, 50);
+        elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+
+        /* errno is left alone on success */
+        errno = EEXIST;
+        ready = poll(&pfd, 1, 1000);
+        err = errno;
+    });
+
+    coco::go([fds] {
+        /* the worker is not blocked by the poll above */
+        struct pollfd pfd = {-1, 0, 0};
+        poll(&pfd, 1, 100);
+
+        char c = 'x';
+        write(fds[1], &c, 1);
+    });
+
+    coco::run();
+
+    ASSERT_EQ(timed_out, 0);
+    ASSERT_GE(elapsed.count(), 50);
+    ASSERT_EQ(ready, 1);
+    ASSERT_EQ(err, EEXIST);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(CocoTest, SelectAndEpollWait)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    int epfd = epoll_create1(0);
+    ASSERT_GE(epfd, 0);
+
+    struct epoll_event evt = {};
+    evt.events = EPOLLIN;
+    evt.data.fd = fds[0];
+    ASSERT_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &evt), 0);
+
+    int selected = -1, waited = -1;
+
+    coco::go([fds, &selected] {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(fds[0], &readfds);
+
+        selected = select(fds[0] + 1, &readfds, nullptr, nullptr, nullptr);
+        if (!FD_ISSET(fds[0], &readfds)) selected = -1;
+    });
+
+    coco::go([epfd, &waited] {
+        struct epoll_event evt;
+        waited = epoll_wait(epfd, &evt, 1, -1);
+    });
+
+    coco::go([fds] {
+        struct pollfd pfd = {-1, 0, 0};
+        poll(&pfd, 1, 20);
+
+        char c = 'x';
+        write(fds[1], &c, 1);
+    });
+
+    coco::run();
+
+    ASSERT_EQ(selected, 1);
+    ASSERT_EQ(waited, 1);
+    /* the caller's epoll fd is not taken over, the hooked fcntl hides
+     * O_NONBLOCK so ask the kernel */
+    std::ifstream fdinfo("/proc/self/fdinfo/" + std::to_string(epfd));
+    std::string key;
+    int flags = -1;
+    while (fdinfo >> key) {
+        if (key == "flags:") {
+            fdinfo >> std::oct >> flags;
+            break;
+        }
+    }
+    ASSERT_NE(flags, -1);
+    ASSERT_FALSE(flags & O_NONBLOCK);
+
+    close(epfd);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(CocoTest, SharedWaiters)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    std::atomic<int> count(0);
+
+    for (int i = 0; i < 16; i++) {
+        coco::go([fds, &count] {
+            char c;
+            if (read(fds[0], &c, 1) == 1) count++;
+        });
+    }
+
+    coco::go([fds] {
+        for (int i = 0; i < 16; i++) {
+            usleep(1000);
+            char c = 'x';
+            write(fds[1], &c, 1);
+        }
+    });
+
+    coco::run();
+
+    ASSERT_EQ(count, 16);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(CocoTest, ReuseFds)
+{
+    std::atomic<int> count(0);
+
+    for (int i = 0; i < 8; i++) {
+        coco::go([&count] {
+            for (int j = 0; j < 200; j++) {
+                int fds[2];
+                if (pipe(fds) != 0) return;
+
+                char c = 'x';
+                if (write(fds[1], &c, 1) == 1 && read(fds[0], &c, 1) == 1) {
+                    count++;
+                }
+
+                close(fds[0]);
+                close(fds[1]);
+            }
+        });
+    }
+
+    coco::run();
+
+    ASSERT_EQ(count, 8 * 200);
+}
+
+TEST(CocoTest, SocketIO)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(listen_fd, 0);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    ASSERT_EQ(listen(listen_fd, 16), 0);
+
+    socklen_t addrlen = sizeof(addr);
+    ASSERT_EQ(getsockname(listen_fd, (struct sockaddr*)&addr, &addrlen), 0);
+
+    coco::go([listen_fd] {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) return;
+
+        char buf[16];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            send(fd, buf, n, 0);
+        }
+
+        close(fd);
+    });
+
+    std::string result;
+    coco::go([&addr, &result] {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) return;
+
+        static char buf[16];
+        struct iovec iov = {buf, sizeof(buf)};
+        coco::ThreadContext::get_current_io_poller()->register_buffers(&iov, 1);
+
+        write(fd, "ping", 4);
+        ssize_t n = read(fd, buf, 4);
+        if (n > 0) result.assign(buf, n);
+
+        coco::ThreadContext::get_current_io_poller()->register_buffers(nullptr,
+                                                                       0);
+        close(fd);
+    });
+
+    coco::run();
+
+    ASSERT_EQ(result, "ping");
+
+    close(listen_fd);
+}
+
+TEST(CocoTest, BlockingCall)
+{
+    std::atomic<bool> blocked(true);
+    bool progressed = false;
+
+    coco::go([&blocked] {
+        int n = coco::blocking([] {
+            usleep(100000);
+            return 42;
+        });
+
+        if (n == 42) blocked = false;
+    });
+
+    coco::go([&blocked, &progressed] {
+        /* other tasks keep running while the call is in progress */
+        for (int i = 0; i < 10; i++)
+            coco::yield();
+        progressed = blocked;
+    });
+
+    coco::run();
+
+    ASSERT_FALSE(blocked);
+    ASSERT_TRUE(progressed);
+}
+
+TEST(CocoTest, FileIO)
+{
+    char path[] = "/tmp/coco_test_XXXXXX";
+    int tmp_fd = mkstemp(path);
+    ASSERT_GE(tmp_fd, 0);
+    ::close(tmp_fd);
+
+    std::string result;
+    off_t size = 0;
+    bool resolved = false;
+    coco::go([&path, &result, &size, &resolved] {
+        int fd = open(path, O_RDWR | O_TRUNC);
+        if (fd < 0) return;
+
+        write(fd, "file", 4);
+        fsync(fd);
+        lseek(fd, 0, SEEK_SET);
+
+        char buf[8] = {0};
+        if (read(fd, buf, 4) == 4) result = buf;
+        close(fd);
+
+        struct stat st;
+        if (!stat(path, &st)) size = st.st_size;
+
+        struct addrinfo* res = nullptr;
+        if (!getaddrinfo("127.0.0.1", nullptr, nullptr, &res)) {
+            resolved = true;
+            freeaddrinfo(res);
+        }
+    });
+
+    coco::run();
+
+    unlink(path);
+
+    ASSERT_EQ(result, "file");
+    ASSERT_EQ(size, 4);
+    ASSERT_TRUE(resolved);
+}
+
+TEST(CocoTest, ZeroCopyTransfer)
+{
+    const size_t size = 4 * 1024 * 1024;
+    std::string data(size, 0);
+    for (size_t i = 0; i < size; i++) {
+        data[i] = 'a' + i % 26;
+    }
+
+    char path[] = "/tmp/coco_test_XXXXXX";
+    int tmp_fd = mkstemp(path);
+    ASSERT_GE(tmp_fd, 0);
+    ASSERT_EQ(::write(tmp_fd, data.data(), size), (ssize_t)size);
+    ::close(tmp_fd);
+
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    coco::go([&path, sv, size] {
+        /* file -> socket, parks whenever the socket buffer is full */
+        int fd = open(path, O_RDONLY);
+        off_t offset = 0;
+        while (offset < (off_t)size) {
+            if (sendfile(sv[0], fd, &offset, size - offset) <= 0) break;
+        }
+        close(fd);
+
+        /* pipe -> socket */
+        int fds[2];
+        if (pipe(fds)) return;
+        write(fds[1], "tail", 4);
+        splice(fds[0], nullptr, sv[0], nullptr, 4, 0);
+        close(fds[0]);
+        close(fds[1]);
+
+        close(sv[0]);
+    });
+
+    std::string received;
+    coco::go([sv, &received] {
+        char buf[64 * 1024];
+        ssize_t n;
+        while ((n = read(sv[1], buf, sizeof(buf))) > 0) {
+            received.append(buf, n);
+        }
+        close(sv[1]);
+    });
+
+    coco::run();
+
+    unlink(path);
+
+    ASSERT_EQ(received, data + "tail");
+}
+
+TEST(CocoTest, SendZeroCopy)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(listen_fd, 0);
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    ASSERT_EQ(listen(listen_fd, 16), 0);
+
+    socklen_t addrlen = sizeof(addr);
+    ASSERT_EQ(getsockname(listen_fd, (struct sockaddr*)&addr, &addrlen), 0);
+
+    const size_t size = 1024 * 1024;
+    std::string data(size, 'z');
+
+    size_t received = 0;
+    coco::go([listen_fd, &received] {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) return;
+
+        char buf[64 * 1024];
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+            received += n;
+        }
+
+        close(fd);
+    });
+
+    size_t sent = 0;
+    coco::go([&addr, &data, &sent] {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr))) return;
+
+        while (sent < data.size()) {
+            ssize_t n =
+                coco::send_zerocopy(fd, &data[sent], data.size() - sent);
+            if (n <= 0) break;
+            sent += n;
+        }
+
+        close(fd);
+    });
+
+    coco::run();
+
+    ASSERT_EQ(sent, size);
+    ASSERT_EQ(received, size);
+
+    close(listen_fd);
+}
+
+TEST(CocoTest, SchedulerStats)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    coco::go([fds] {
+        char c;
+        read(fds[0], &c, 1);
+        close(fds[0]);
+    });
+
+    coco::go([fds] {
+        for (int i = 0; i < 10; i++) {
+            coco::yield();
+        }
+        write(fds[1], "x", 1);
+        close(fds[1]);
+    });
+
+    coco::SchedulerStats stats;
+    coco::go([&stats] {
+        coco::yield();
+        stats = coco::Scheduler::get_instance().stats();
+    });
+
+    coco::run();
+
+    ASSERT_EQ(stats.workers.size(), stats.total.tid);
+    ASSERT_EQ(stats.total.spawns, 3u);
+    ASSERT_GT(stats.total.context_switches, 0u);
+    ASSERT_GE(stats.total.parks, 1u);
+    ASSERT_GE(stats.live_tasks, 1u);
+    ASSERT_GE(stats.total.stack_reserved, 1024 * 1024);
+}
+
+TEST(CocoTest, LatencyHistograms)
+{
+    auto* task_class = coco::TaskClass::get("histogram_test");
+    auto spawn = [task_class] {
+        for (int i = 0; i < 10; i++) {
+            coco::go(task_class, [] {
+                for (int j = 0; j < 10; j++) {
+                    coco::yield();
+                }
+            });
+        }
+    };
+
+    /* nothing is recorded until asked for */
+    spawn();
+    coco::run();
+
+    auto stats = coco::latency_stats();
+    auto it = std::find_if(stats.begin(), stats.end(), [](auto& s) {
+        return s.label == "histogram_test";
+    });
+    ASSERT_NE(it, stats.end());
+    ASSERT_EQ(it->sched_delay.count, 0u);
+    ASSERT_EQ(it->run_time.count, 0u);
+
+    coco::enable_latency_stats();
+    spawn();
+    coco::run();
+    coco::disable_latency_stats();
+
+    stats = coco::latency_stats();
+    it = std::find_if(stats.begin(), stats.end(), [](auto& s) {
+        return s.label == "histogram_test";
+    });
+    ASSERT_NE(it, stats.end());
+
+    /* every resume after a yield is one delay sample */
+    ASSERT_GE(it->sched_delay.count, 100u);
+    ASSERT_GE(it->run_time.count, 100u);
+    ASSERT_LE(it->sched_delay.percentile(50), it->sched_delay.max);
+    ASSERT_GT(it->run_time.max, 0u);
+}
+
+TEST(CocoTest, StackProfiling)
+{
+    coco::enable_stack_profiling(true);
+
+    for (int i = 0; i < 10; i++) {
+        coco::go("stack_test", [] {
+            volatile char buf[8192];
+            for (size_t j = 0; j < sizeof(buf); j++) {
+                buf[j] = j;
+            }
+        });
+    }
+
+    coco::run();
+
+    auto stats = coco::latency_stats();
+    auto it = std::find_if(stats.begin(), stats.end(), [](auto& s) {
+        return s.label == "stack_test";
+    });
+    ASSERT_NE(it, stats.end());
+    ASSERT_GE(it->stack_samples, 10u);
+    ASSERT_GE(it->stack_peak, 8192u);
+    ASSERT_LT(it->stack_peak, 64u * 1024);
+    ASSERT_LE(it->stack_mean, it->stack_peak);
+
+    /* later tasks of the label get a stack sized from the peak */
+    size_t stacksize = 0;
+    coco::go("stack_test", [&stacksize] {
+        stacksize = coco::ThreadContext::get_current_task()->get_stacksize();
+    });
+    coco::run();
+
+    coco::disable_stack_profiling();
+
+    ASSERT_GE(stacksize, 2 * 8192u);
+    ASSERT_LT(stacksize, 1024u * 1024);
+}
+
+static __attribute__((noinline)) size_t recurse_deep(int depth)
+{
+    volatile char buf[1024];
+    buf[0] = depth;
+    if (depth == 0) return buf[0];
+    return recurse_deep(depth - 1) + buf[0];
+}
+
+TEST(CocoTest, GrowableStacks)
+{
+    ASSERT_TRUE(coco::enable_growable_stacks());
+
+    size_t committed_before = 0, committed_after = 0;
+    coco::go(
+        [&] {
+            auto* task = coco::ThreadContext::get_current_task();
+            committed_before = task->get_stack_committed();
+            recurse_deep(2048);
+            committed_after = task->get_stack_committed();
+        },
+        8 * 1024 * 1024);
+
+    coco::run();
+
+    coco::disable_growable_stacks();
+
+    /* 2 MiB of frames in a stack which started out with a few pages */
+    ASSERT_LT(committed_before, 64u * 1024);
+    ASSERT_GE(committed_after, 2u * 1024 * 1024);
+    ASSERT_LE(committed_after, 8u * 1024 * 1024);
+}
+
+TEST(CocoTest, SlabAllocator)
+{
+    struct Node : coco::SlabObject {
+        int value;
+    };
+
+    /* freed by another thread, handed out again by the owner */
+    std::vector<Node*> nodes;
+    for (int i = 0; i < 10000; i++) {
+        nodes.push_back(new Node);
+        nodes.back()->value = i;
+    }
+    std::set<Node*> freed(nodes.begin(), nodes.end());
+    std::thread([&nodes] {
+        for (auto* node : nodes) {
+            delete node;
+        }
+    }).join();
+
+    size_t reused = 0;
+    for (int i = 0; i < 10000; i++) {
+        nodes[i] = new Node;
+        if (freed.count(nodes[i])) reused++;
+    }
+    for (auto* node : nodes) {
+        delete node;
+    }
+    ASSERT_GT(reused, 0u);
+
+    std::atomic<int> sum(0);
+    for (int i = 0; i < 10; i++) {
+        coco::go([&sum] {
+            std::vector<int, coco::SlabAllocator<int>> v;
+            for (int j = 0; j < 100; j++) {
+                v.push_back(j);
+                coco::yield();
+            }
+            auto p = std::allocate_shared<int>(coco::SlabAllocator<int>(),
+                                               v.back());
+            sum += *p;
+        });
+    }
+
+    coco::run();
+
+    ASSERT_EQ(sum.load(), 990);
+}
+
+TEST(CocoTest, RunEndsOnQuiescence)
+{
+    /* nothing to wait for */
+    coco::run();
+
+    /* each run used to wait for the next 10 ms monitor tick */
+    auto start = std::chrono::steady_clock::now();
+    int count = 0;
+    for (int i = 0; i < 100; i++) {
+        coco::go([&count] {
+            coco::yield();
+            count++;
+        });
+        coco::run();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    ASSERT_EQ(count, 100);
+    ASSERT_EQ(coco::Scheduler::get_instance().get_live_tasks(), 0u);
+    ASSERT_LT(elapsed, std::chrono::milliseconds(500));
+}
+
+TEST(CocoTest, PersistentWorkers)
+{
+    auto& sched = coco::Scheduler::get_instance();
+    sched.set_persistent(true);
+
+    /* the same workers and pollers serve every run */
+    std::mutex mutex;
+    std::set<coco::IOPoller*> pollers;
+    int count = 0;
+    for (int i = 0; i < 100; i++) {
+        for (int j = 0; j < 4; j++) {
+            coco::go([&] {
+                std::lock_guard<std::mutex> lock(mutex);
+                pollers.insert(coco::ThreadContext::get_current_io_poller());
+                count++;
+            });
+        }
+        coco::run();
+    }
+
+    sched.set_persistent(false);
+    coco::shutdown();
+
+    ASSERT_EQ(count, 400);
+    ASSERT_LE(pollers.size(), 2u);
+}
+
+TEST(CocoTest, MultipleSchedulers)
+{
+    coco::Scheduler serving(1), batch(2);
+    serving.set_affinity({0});
+
+    /* keeps batch running until serving is done with it */
+    coco::Promise<void> done;
+    auto done_future = done.get_future();
+    batch.go([&done_future] { done_future.get(); }, 64 * 1024);
+
+    coco::Scheduler* ran_on = nullptr;
+    bool caught = false;
+    int cpu = -1;
+    serving.go(
+        [&] {
+            cpu = sched_getcpu();
+            auto f = coco::submit(batch, [] {
+                coco::go([] {}); /* stays on batch */
+                return coco::Scheduler::get_current();
+            });
+            ran_on = f.get();
+
+            auto g = coco::submit(batch, [] { throw std::runtime_error("x"); });
+            try {
+                g.get();
+            } catch (std::runtime_error&) {
+                caught = true;
+            }
+
+            done.set_value();
+        },
+        64 * 1024);
+
+    std::thread batch_thread([&batch] { batch.run(); });
+    serving.run();
+    batch_thread.join();
+
+    ASSERT_EQ(ran_on, &batch);
+    ASSERT_TRUE(caught);
+    ASSERT_EQ(batch.get_live_tasks(), 0u);
+
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    if (CPU_ISSET(0, &allowed)) {
+        ASSERT_EQ(cpu, 0);
+    }
+}
+
+TEST(CocoTest, CrossSchedulerSpawns)
+{
+    coco::Scheduler serving(1), batch(1);
+
+    coco::Promise<void> done;
+    auto done_future = done.get_future();
+    batch.go([&done_future] { done_future.get(); }, 64 * 1024);
+
+    /* the idle batch worker has to be woken up for every task */
+    std::chrono::steady_clock::duration elapsed{};
+    serving.go(
+        [&] {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < 20; i++) {
+                coco::submit(batch, [] {}).get();
+            }
+            elapsed = std::chrono::steady_clock::now() - start;
+            done.set_value();
+        },
+        64 * 1024);
+
+    std::thread batch_thread([&batch] { batch.run(); });
+    serving.run();
+    batch_thread.join();
+
+    ASSERT_LT(elapsed, std::chrono::milliseconds(40));
+}
+
+TEST(CocoTest, SpawnsAcrossRuns)
+{
+    coco::Scheduler sched(2);
+
+    /* tasks queued while a run ends are kept for the next one */
+    std::atomic<int> count{0};
+    std::atomic<bool> spawned{false};
+    std::thread spawner([&] {
+        for (int i = 0; i < 200; i++) {
+            sched.go([&count] { count++; }, 64 * 1024);
+        }
+        spawned = true;
+    });
+
+    while (!spawned || sched.get_live_tasks()) {
+        sched.run();
+    }
+    spawner.join();
+
+    ASSERT_EQ(count.load(), 200);
+}
+
+TEST(CocoTest, JoinHandles)
+{
+    int sum = 0;
+    bool caught = false;
+    size_t first = SIZE_MAX;
+
+    coco::go([&] {
+        std::vector<coco::JoinHandle<int>> handles;
+        for (int i = 0; i < 1000; i++) {
+            handles.push_back(coco::spawn([i] { return i; }, 16 * 1024));
+        }
+        for (int v : coco::when_all(handles)) {
+            sum += v;
+        }
+
+        /* the exception goes to the joiner, the scheduler keeps going */
+        auto failing = coco::spawn([]() -> int {
+            coco::yield();
+            throw std::runtime_error("failed");
+        });
+        try {
+            failing.get();
+        } catch (std::runtime_error&) {
+            caught = true;
+        }
+
+        coco::Promise<void> gate;
+        auto gate_future = gate.get_future();
+        std::vector<coco::JoinHandle<void>> racers;
+        racers.push_back(coco::spawn([&gate_future] { gate_future.get(); }));
+        racers.push_back(coco::spawn([] {}));
+        first = coco::when_any(racers);
+        gate.set_value();
+        coco::when_all(racers);
+    });
+
+    coco::run();
+
+    ASSERT_EQ(sum, 999 * 1000 / 2);
+    ASSERT_TRUE(caught);
+    ASSERT_EQ(first, 1u);
+}
+
+TEST(CocoTest, ParallelLoops)
+{
+    coco::Scheduler sched(4);
+    std::vector<std::atomic<int>> hits(10000);
+    uint64_t sum = 0;
+    std::string joined;
+    std::atomic<int> invoked{0};
+    bool caught = false;
+
+    sched.go(
+        [&] {
+            coco::parallel_for(0, hits.size(), [&](size_t i) { hits[i]++; });
+
+            sum = coco::parallel_reduce(
+                0, 100000, uint64_t(0), [](size_t i) { return (uint64_t)i; },
+                [](uint64_t a, uint64_t b) { return a + b; });
+
+            /* combined in index order */
+            joined = coco::parallel_reduce(
+                0, 26, std::string(),
+                [](size_t i) { return std::string(1, 'a' + i); },
+                [](std::string a, std::string b) { return a + b; }, 3);
+
+            coco::parallel_invoke([&] { invoked.fetch_or(1); },
+                                  [&] { invoked.fetch_or(2); },
+                                  [&] { invoked.fetch_or(4); });
+
+            try {
+                coco::parallel_for(0, 1000, [](size_t i) {
+                    if (i == 500) throw std::runtime_error("failed");
+                });
+            } catch (std::runtime_error&) {
+                caught = true;
+            }
+        },
+        1 * 1024 * 1024);
+
+    sched.run();
+
+    for (auto& hit : hits) {
+        ASSERT_EQ(hit.load(), 1);
+    }
+    ASSERT_EQ(sum, 99999ull * 100000 / 2);
+    ASSERT_EQ(joined, "abcdefghijklmnopqrstuvwxyz");
+    ASSERT_EQ(invoked.load(), 7);
+    ASSERT_TRUE(caught);
+}
+
+#ifdef COCO_HAS_COROUTINES
+static coco::async<int> async_square(int x) { co_return x * x; }
+
+static coco::async<int> async_sum_squares(int n)
+{
+    int sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += co_await async_square(i);
+    }
+    co_return sum;
+}
+
+static coco::async<int> async_double_submitted()
+{
+    int v = co_await coco::submit(*coco::Scheduler::get_current(), [] {
+        coco::yield();
+        return 21;
+    });
+    co_return 2 * v;
+}
+
+static coco::async<int> async_wait_flag(coco::Futex<int>& futex,
+                                        std::atomic<int>& flag)
+{
+    while (!flag.load()) {
+        co_await coco::futex_wait(futex, flag, 0);
+    }
+    co_return flag.load();
+}
+
+static coco::async<std::string> async_read_all(int fd, size_t len)
+{
+    std::string buf(len, '\0');
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = co_await coco::async_read(fd, &buf[got], len - got);
+        if (n <= 0) break;
+        got += n;
+    }
+    co_return buf.substr(0, got);
+}
+
+static coco::async<void> async_fail()
+{
+    co_await async_square(1);
+    throw std::runtime_error("failed");
+}
+
+TEST(CocoTest, AsyncCoroutines)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    int sum = 0, doubled = 0, flag_value = 0;
+    std::string received;
+    bool caught = false;
+
+    coco::go([&] {
+        /* stackful tasks wait for coroutines */
+        std::vector<coco::Future<int>> futures;
+        for (int i = 0; i < 1000; i++) {
+            futures.push_back(coco::launch(async_sum_squares(10)));
+        }
+        for (auto& future : futures) {
+            sum += future.get();
+        }
+
+        /* and coroutines for stackful tasks */
+        doubled = coco::launch(async_double_submitted()).get();
+
+        coco::Futex<int> futex;
+        std::atomic<int> flag{0};
+        auto waiter = coco::launch(async_wait_flag(futex, flag));
+        coco::yield();
+        flag = 5;
+        futex.wake(SIZE_MAX);
+        flag_value = waiter.get();
+
+        /* the reader waits for the pipe without parking its driver */
+        auto reader = coco::launch(async_read_all(fds[0], 4));
+        coco::yield();
+        write(fds[1], "test", 4);
+        received = reader.get();
+
+        try {
+            coco::launch(async_fail()).get();
+        } catch (std::runtime_error&) {
+            caught = true;
+        }
+    });
+
+    coco::run();
+
+    ASSERT_EQ(sum, 1000 * 285);
+    ASSERT_EQ(doubled, 42);
+    ASSERT_EQ(flag_value, 5);
+    ASSERT_EQ(received, "test");
+    ASSERT_TRUE(caught);
+}
+#endif
+
+TEST(CocoTest, CoopBudget)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+
+    std::vector<char> data(4096, 'x');
+    ASSERT_EQ(write(fds[1], data.data(), data.size()), 4096);
+
+    unsigned int saved = coco::get_coop_budget();
+    coco::set_coop_budget(16);
+
+    /* the reader always finds data and never parks */
+    coco::Scheduler sched(1);
+    int reads = 0, seen = -1;
+    uint64_t coop_yields = 0;
+    sched.go(
+        [&] {
+            char c;
+            for (size_t i = 0; i < data.size(); i++) {
+                ASSERT_EQ(read(fds[0], &c, 1), 1);
+                reads++;
+            }
+            coop_yields = sched.stats().total.coop_yields;
+        },
+        1 * 1024 * 1024);
+    sched.go([&] { seen = reads; }, 1 * 1024 * 1024);
+
+    sched.run();
+    coco::set_coop_budget(saved);
+
+    ASSERT_GT(seen, 0);
+    ASSERT_LT(seen, 4096);
+    ASSERT_GE(coop_yields, 4096u / 16 - 1);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(CocoTest, TraceTimeline)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    coco::Tracer::get_instance().start();
+
+    coco::go("trace_reader", [fds] {
+        char c;
+        read(fds[0], &c, 1);
+        close(fds[0]);
+    });
+
+    coco::go("trace_writer", [fds] {
+        usleep(20000); /* let the reader park on the empty pipe */
+        write(fds[1], "x", 1);
+        close(fds[1]);
+    });
+
+    coco::run();
+
+    coco::Tracer::get_instance().stop();
+
+    std::ostringstream os;
+    coco::Tracer::get_instance().write_json(os);
+    std::string json = os.str();
+
+    ASSERT_EQ(json.find("{\"traceEvents\":["), 0u);
+    ASSERT_NE(json.find("\"name\":\"trace_reader\""), std::string::npos);
+    ASSERT_NE(json.find("\"name\":\"trace_writer\""), std::string::npos);
+    ASSERT_NE(json.find("\"reason\":\"io\""), std::string::npos);
+    ASSERT_NE(json.find("\"name\":\"wake\""), std::string::npos);
+    ASSERT_NE(json.find("\"name\":\"terminate\""), std::string::npos);
+}
+
+TEST(CocoTest, DumpTasks)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+
+    coco::go("dump_reader", [fds] {
+        char c;
+        read(fds[0], &c, 1);
+        close(fds[0]);
+    });
+
+    std::string dump;
+    coco::go([fds, &dump] {
+        /* let the reader park first */
+        for (int i = 0; i < 10; i++) {
+            coco::yield();
+        }
+
+        std::ostringstream os;
+        coco::dump_tasks(os);
+        dump = os.str();
+
+        write(fds[1], "x", 1);
+        close(fds[1]);
+    });
+
+    coco::run();
+
+    std::string parked = "[dump_reader] sleeping (io fd " +
+                         std::to_string(fds[0]) + ")\n    #0 ";
+    ASSERT_NE(dump.find(parked), std::string::npos) << dump;
+}
+
+TEST(CocoTest, PerfMap)
+{
+    coco::enable_perf_map();
+
+    /* a label is mapped once per process, repeated runs need new ones */
+    static int runs = 0;
+    std::string label = "perf_map_test" + std::to_string(runs++);
+
+    int count = 0;
+    for (int i = 0; i < 4; i++) {
+        coco::go(label.c_str(), [&count] {
+            coco::yield();
+            count++;
+        });
+    }
+
+    coco::run();
+
+    ASSERT_EQ(count, 4);
+
+    std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+    FILE* fp = fopen(path.c_str(), "r");
+    ASSERT_NE(fp, nullptr);
+
+    std::string entry = " coco_task[" + label + "]\n";
+    char line[256];
+    int found = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (strstr(line, entry.c_str())) found++;
+    }
+    fclose(fp);
+
+    coco::disable_perf_map();
+    unlink(path.c_str());
+
+    ASSERT_EQ(found, 1);
+}
+
+static std::atomic<uint64_t> long_slice_ns{0};
+
+TEST(CocoTest, Watchdog)
+{
+    auto& sched = coco::Scheduler::get_instance();
+    ASSERT_TRUE(sched.set_watchdog(20000));
+    sched.set_slice_handler([](uint64_t, size_t, uint64_t running_ns) {
+        long_slice_ns.store(running_ns);
+    });
+
+    coco::SchedulerStats stats;
+    coco::go([&sched, &stats] {
+        /* hog the worker without ever switching */
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+        while (std::chrono::steady_clock::now() < deadline)
+            ;
+        stats = sched.stats();
+    });
+
+    coco::run();
+    sched.set_watchdog(0);
+    sched.set_slice_handler(nullptr);
+
+    ASSERT_GE(stats.total.long_slices, 1u);
+    ASSERT_EQ(stats.total.preemptions, 0u);
+    ASSERT_GE(long_slice_ns.load(), 20000000u);
+}
+
+static void spin_until(std::atomic<bool>& flag)
+{
+    while (!flag.load(std::memory_order_relaxed))
+        ;
+}
+
+TEST(CocoTest, Preemption)
+{
+    auto& sched = coco::Scheduler::get_instance();
+    if (!sched.set_watchdog(5000, true)) GTEST_SKIP();
+
+    /* more spinners than workers, the one which releases them only gets to
+     * run if they are preempted */
+    std::atomic<bool> release(false);
+    std::atomic<int> done(0);
+    for (int i = 0; i < 4; i++) {
+        coco::go([&release, &done] {
+            spin_until(release);
+            done++;
+        });
+    }
+    coco::go([&release] { release = true; });
+
+    coco::run();
+    sched.set_watchdog(0);
+
+    ASSERT_EQ(done, 4);
+}
+
 TEST(CocoTest, ConditionmVariable)
 {
     coco::ConditionVariableAny cv;
@@ -164,3 +1414,93 @@ TEST(CocoTest, SharedMutex)
 
     ASSERT_EQ(a, 100);
 }
+
+TEST(CocoTest, Stream)
+{
+    int sv[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, sv), 0);
+
+    const int count = 1000;
+    std::string payload(100 * 1024, 'x');
+
+    coco::go([sv, &payload] {
+        /* small buffers to exercise back-pressure and wrap-around */
+        coco::Stream stream(sv[0], 64, 64);
+        for (int i = 0; i < count; i++) {
+            std::string line = "line " + std::to_string(i) + "\n";
+            stream.write(line.data(), line.size());
+        }
+
+        uint32_t len = payload.size();
+        stream.write(&len, sizeof(len));
+        stream.write(payload.data(), payload.size());
+        stream.write("end", 3);
+        stream.flush();
+
+        close(sv[0]);
+    });
+
+    std::vector<std::string> lines;
+    std::string received;
+    std::string rest;
+    coco::go([sv, &lines, &received, &rest] {
+        coco::Stream stream(sv[1], 64, 64);
+        std::string line;
+        for (int i = 0; i < count; i++) {
+            if (stream.read_until('\n', line) <= 0) break;
+            lines.push_back(line);
+        }
+
+        uint32_t len = 0;
+        char header[sizeof(len)];
+        if (stream.peek(header, sizeof(header)) != sizeof(header)) return;
+        stream.read_exact(&len, sizeof(len));
+        received.resize(len);
+        received.resize(std::max<ssize_t>(
+            stream.read_exact(&received[0], len), 0));
+
+        stream.read_until('\n', rest);
+        close(sv[1]);
+    });
+
+    coco::run();
+
+    ASSERT_EQ(lines.size(), (size_t)count);
+    for (int i = 0; i < count; i++) {
+        ASSERT_EQ(lines[i], "line " + std::to_string(i) + "\n");
+    }
+    ASSERT_EQ(received, payload);
+    ASSERT_EQ(rest, "end");
+}
+
+TEST(CocoTest, StreamShortWrite)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    auto old_handler = signal(SIGPIPE, SIG_IGN);
+
+    /* the reader goes away once the pipe is full */
+    std::string big(1024 * 1024, 'y');
+    ssize_t n = 0;
+    size_t pending = 1;
+    coco::go([fds, &big, &n, &pending] {
+        coco::Stream stream(fds[1], 64, 64);
+        stream.write("ab", 2);
+        n = stream.write(big.data(), big.size());
+        pending = stream.pending();
+        close(fds[1]);
+    });
+
+    coco::go([fds] {
+        usleep(20000);
+        close(fds[0]);
+    });
+
+    coco::run();
+    signal(SIGPIPE, old_handler);
+
+    /* what made it is reported and not sent again */
+    ASSERT_GT(n, 0);
+    ASSERT_LT(n, (ssize_t)big.size());
+    ASSERT_EQ(pending, 0u);
+}